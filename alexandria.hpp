@@ -31,6 +31,13 @@ Released freely under the Unlicense, except where sources are cited.
 // Compilation Settings
 //#define USE_ALEXANDRIA_NAMESPACE // If uncommented or otherwise defined, will make ALL of the following (except macros and defines) part of the Alexandria:: namespace
 //#define USE_ALEXANDRIA_COLORLESS // Use colorless testing and output for other functions, useful for OSs like Windows that just don't play nice with color :<
+//#define USE_ALEXANDRIA_TSC // If uncommented or otherwise defined, TIME macros read the CPU's timestamp counter on x86, printing nanoseconds and cycles instead of milliseconds
+//#define USE_ALEXANDRIA_PERF_COUNTERS // If uncommented or otherwise defined, TIME macros also read Linux perf_event counters, printing IPC and cache/branch miss rates
+//#define USE_ALEXANDRIA_ALLOC_TRACKING // If uncommented or otherwise defined, replaces global operator new/delete to count heap allocations per thread, for ALLOC_SCOPE(n)
+//#define USE_ALEXANDRIA_ASYNC_LOG // If uncommented or otherwise defined, LOG/PASS/WARNING/ERROR are queued and written by a background thread, to stdout and/or a file
+//#define USE_ALEXANDRIA_BINARY_LOG // If uncommented or otherwise defined, LOG/PASS/WARNING/ERROR write raw binary records to a file instead of text, see alexandria_log_decoder.cpp
+//#define USE_ALEXANDRIA_FLIGHT_RECORDER // If uncommented or otherwise defined, LOG/PASS/WARNING/ERROR/TIME events are kept in per-thread rings (even without DEBUG) and dumped to a file on a crash
+//#define USE_ALEXANDRIA_NO_SIMD // If uncommented or otherwise defined, Vector3Array and other batch math use plain loops instead of SSE/AVX intrinsics
 //#define DEBUG // If uncommented, logs, errors, and warnings will be printed to the console (they print in DEBUG mode, and are silent otherwise)
 
 /*
@@ -48,10 +55,42 @@ Macros / Defines:
     INFO_NOVALUE(x): Prints a line identical to ^, but does not require a defined << operator for custom structs and classes
     INFO_BASIC(x): Prints variable/value name and type ONLY. Able to be used with atomic types
     LOCATION: A std::string "filename:line:function" corresponding to where this macro is used in the source code
+    SOURCE_LOCATION: A SourceLocation equivalent of LOCATION, built from compile-time constants only (no allocation). Printable with << or to_string()
     COMPILE_TIME: A std::string containing the time and date of program compilation
     MONO_<CHARACTER/SYMBOL>: An array of Point2s referring to the (x,y) locations of color for that character in the monospace font. Origin is top-left. Dimensions: 5px ascender, 5x5px lowercase, 2px descender, add 1px space
     TIME(x): Times whatever takes place within the parentheses and prints the elapsed time to the console
     TIME_NAMED(n, x): Times whatever takes place within the parentheses and prints the elapsed time to the console with the name n
+        When USE_ALEXANDRIA_TSC is defined on x86, both TIME macros instead read the CPU's timestamp counter (serialized, calibrated against steady_clock at startup)
+            and print nanoseconds and cycles, less the cost of reading the counter. Elsewhere they fall back to std::chrono and milliseconds
+        When USE_ALEXANDRIA_PERF_COUNTERS is defined on Linux, both TIME macros also print the calling thread's IPC and L1d/LLC/branch miss rates from perf_event
+            If hardware counters are forbidden (perf_event_paranoid > 2, or a VM without a PMU), software counters are printed instead: task-clock, page faults, etc.
+    TIME_HISTOGRAM(h, x): Times whatever takes place within the parentheses and records the elapsed nanoseconds into the LatencyHistogram h, without printing
+        LatencyHistogram is log-linear (values kept to within about 3%, see HISTOGRAM_SUB_BUCKET_BITS) and safe to record into from any number of threads
+        h.snapshot() copies it out as a LatencyHistogramSnapshot, which can be merged with others, queried with percentile(p), mean(), min, and max, and printed
+    BENCH(n, x): Micro-benchmarks the expression x under the name n, printing the min/median/p99 nanoseconds per evaluation
+        Warms up, then calibrates how many evaluations make up each of the timed samples (see the BENCH_* settings), and keeps x's result from being optimized away
+        Also available as run_benchmark(name, location, function, bytes, items, print), which returns the BenchResult
+    BENCH_BYTES(n, b, x): Same as BENCH, and also prints throughput given that one evaluation of x processes b bytes
+    BENCH_ITEMS(n, i, x): Same as BENCH, and also prints throughput given that one evaluation of x processes i items
+    do_not_optimize(value): Keeps the compiler from optimizing away a value, or the work done to produce it, for use in benchmarks
+    PROFILE_SCOPE(n): Profiles the rest of the enclosing scope under the string name n, counting calls and total/min/max/mean nanoseconds without printing
+        Scopes nest, so each thread builds a tree of call sites (a site reached through two different parents is counted separately under each)
+    PROFILE_REPORT(): Prints the profile tree of every thread, each level sorted by inclusive time, alongside self time
+        Also available as profile_report(std::ostream& out). Only call while no other thread is inside a profiled scope
+    TRACE_START(): Starts recording every TIME, TIME_NAMED, and TRACE_SCOPE section (with its thread) into per-thread ring buffers, clearing earlier events
+        Each thread keeps its newest TRACE_BUFFER_EVENTS events. Recording never allocates or locks after a thread's first event
+    TRACE_STOP(): Stops recording timed sections
+    TRACE_SAVE(path): Writes the recorded sections to path as Chrome trace-event JSON, to open in Perfetto (ui.perfetto.dev) or chrome://tracing
+        Returns false if the file couldn't be written. Only call after TRACE_STOP(), once traced threads are done
+    TRACE_SCOPE(n): Records the rest of the enclosing scope under the name n while tracing, without printing anything
+    METRIC_COUNTER(var, n, help), METRIC_GAUGE(var, n, help), METRIC_HISTOGRAM(var, n, help): Declare a metric variable var named n, registered with its location
+        Counters add(amount), gauges set(value) or add(amount), and histograms record(value), each with relaxed atomics and no lookup
+    METRIC_INCREMENT(n), METRIC_ADD(n, x), METRIC_SET(n, x), METRIC_RECORD(n, x), METRIC_TIME(n, x): Update a metric named n (a string literal) declared in place, as a static of this line
+        Each is one statement, followed by a semicolon. METRIC_TIME times whatever takes place within the parentheses into a histogram, as TIME_HISTOGRAM does
+    metrics_start_export(path, interval_ms): Starts a background thread writing every metric to path in the Prometheus text format each interval_ms
+        The file is replaced atomically (written then renamed). Histograms are written as summaries of p50/p90/p99/p99.9. Also see metrics_write(out)
+    ALLOC_SCOPE(n): Counts the heap allocations, bytes, frees, and peak live bytes of the calling thread over the rest of the enclosing scope, printing them under the name n when it ends
+        Only does anything if USE_ALEXANDRIA_ALLOC_TRACKING is defined, which replaces the global operator new and delete. alloc_stats() returns the thread's totals
     BLACK, WHITE, RED, GREEN, BLUE, YELLOW, CYAN, MAGENTA, GRAY: Color struct definitions for basic colors
     PRINT_VECTOR(x): Prints the contents of a vector x to the console as well as the name of the vector
 
@@ -59,11 +98,33 @@ Debug Printing: (NOTE That these will only print if DEBUG is defined. Else, they
     LOG(x): Prints the string x as a blue log message
     PASS(x): Prints the string x as a green pass message
     WARNING(x): Prints the string x as a yellow warning message
+        Rate limited per call site: only the first WARNING_RATE_LIMIT_FIRST messages print, then every WARNING_RATE_LIMIT_EVERY-th, noting how many were suppressed
+            The limit is checked with one relaxed atomic increment, before x is formatted. Suppressed messages aren't compared, so they may differ
+            Those suppressed after the last printed one are summarized by LOG_FLUSH() and at exit, see log_rate_limit_summary()
     ERROR(x): Prints the string x as a red error message
+        Each is one complete statement in every configuration, written without a semicolon: if (failed) ERROR("Failed") else PASS("Passed")
+        When USE_ALEXANDRIA_ASYNC_LOG is defined, these 4 instead format x on the calling thread into a bounded lock-free queue, and a background thread writes
+            them in batches to std::cout (see log_set_stdout(enabled)) and/or a file (see log_set_file(path)). Messages are truncated at LOG_MESSAGE_SIZE bytes
+            log_set_policy(LOG_BLOCK/LOG_DROP/LOG_OVERWRITE) sets what happens when LOG_QUEUE_SIZE messages are already waiting. Waiting messages are written at exit
+        When USE_ALEXANDRIA_BINARY_LOG is defined (which takes precedence), these 4 instead append only a per-call-site id and the raw bytes of the values
+            streamed in x to a per-thread buffer, written to BINARY_LOG_PATH or binary_log_open(path). Decode the file with alexandria_log_decoder.cpp,
+            or binary_log_decode(in, out, show_locations), back into the same text. Values of other types (and long doubles) are formatted at the call site
+            Manipulators (std::hex, std::setprecision(n), std::setw(n), ...) are recorded and applied by the decoder, but only within their own message
+        When USE_ALEXANDRIA_FLIGHT_RECORDER is defined, these 4 (even without DEBUG, and even if filtered by level) and both TIME macros also record an event, of
+            their location, time, and source text, in a per-thread ring of the last FLIGHT_RECORDER_EVENTS events. On SIGSEGV, SIGABRT, SIGBUS, SIGFPE, or SIGILL,
+            every thread's ring is dumped to FLIGHT_RECORDER_PATH (or flight_recorder_install(path)) using only async-signal-safe calls
+            The handler runs on an alternate stack, so that a stack overflow is dumped too. Only the installing thread gets one automatically,
+            other threads need to call flight_recorder_signal_stack() for a stack overflow on them to be dumped
+    FLIGHT_RECORD(text, value): Records an event with the string literal text and integer value in the flight recorder, if USE_ALEXANDRIA_FLIGHT_RECORDER is defined
+    LOG_FLUSH(): Waits until every message logged so far has been written out (for the binary log, only those of the calling thread)
+    LOG_LEVEL_<NONE/ERROR/WARNING/PASS/LOG>: Log levels, from most to least severe. Messages above LOG_LEVEL_COMPILED are compiled out entirely
+        Messages above their module's runtime level are skipped before x is evaluated. log_set_level(level) sets the default module's level,
+            and log_set_level(name, level) any other's. Define modules as globals, LogModule render_log("render"), and send messages to them by
+            redefining ALEXANDRIA_LOG_MODULE (render_log) around the code that logs them
 
 Testing Macros and Values:
     Unit test macros:
-        TEST(x): Tests if a value or expression x is true. Basic unit test. Grants the least amount of information (only file/line location)
+        TEST(x): Tests if a value or expression x is true. Basic unit test. Comparisons (x < y, x == y, etc.) are decomposed to print both sides on failure
         TEST_NAMED(n, x): Same as above, but adds a string name n for easier tracking through output and statistics
         TEST_EQ(x, y): Tests if (x == y), basic unit test. Stores and prints the values of x and y and test output in color according to pass/fail along with file and line location
         TEST_NAMED_EQ(n, x, y): See above, but also stores the name string n to the test for future reference alongside file and line numbers
@@ -71,20 +132,59 @@ Testing Macros and Values:
         TEST_NEQ(x, y): Same as TEST_EQ for inequality
         TEST_NAMED_NEQ(n, x, y): Same as TEST_NAMED_EQ for inequality
         TEST_EPSILON_NEQ(x, y, e): Same as TEST_EPSILON_EQ for inequality
+        Note that every operand of every test macro is evaluated exactly once, and only formatted into text if the test fails
+            Values without a stream operator print as {?}. Test expressions using ?: or = must be parenthesized
+    Test case macros:
+        TEST_CASE(n) { ... }: Registers the following block as a test case with the string name n, to be run later by RUN_TEST_CASES(). Use at file scope
+        RUN_TEST_CASES(): Runs all registered test cases across a pool of threads (one per core), with the output of each case printed as one block
+            Also available as run_test_cases(unsigned int thread_count) for a specific number of threads
+            Results are merged into the same totals as inline tests, so TEST_SUMMARY() covers both
+        Note that all test macros are safe to use from any thread. Each thread counts into its own results, which are summed by TEST_SUMMARY()
     Meta-test variables and macros:
         TESTS_SILENT: A boolean variable, default false. If set to true, tests will be silent other than TEST_SUMMARY() below
             Note that this can be toggled true/false multiple times within the code base, allowing verbose explanation and printing of a select subset of tests
+            Note also that this should not be toggled from within test cases, as they may run in parallel
         TEST_SUMMARY(): Print a number of test summary statistics, such as passed/total tests, test percentage, and a list of all failed tests, locations, and names (if any)
+        TESTS_FLUSH(): Test output is buffered per thread and only written out on failures, at the end of test cases, and by TEST_SUMMARY(). This writes it out now
+            Useful before printing your own output if its ordering against test output matters
+            Passing tests never allocate or flush, and failure strings are only built for tests that fail
+        TESTS_TOTAL, TESTS_SUCCESSFUL, TESTS_FAILURES: The totals printed by TEST_SUMMARY(), always current. The counts are summed over every thread when read
 
 Structs:
-    Point2: A basic 2D point (of integers)
-        Supported operators: <<
-    Point3: A basic 3D point (of integers)
-        Supported operators: <<
-    Vector3: A basic 3D floating-point vector
-        Supported operators: +, -, *, /, <<
-        Supported functions: magnitude(Vector3), normalize(Vector3), cross(Vector3, Vector3), dot(Vector3, Vector3), angle(Vector3, Vector3)
+    Vec<N, T>: A vector of N components of type T, as a plain aggregate with components x, y, z, w (for N up to 4) and [] for any N
+        Supported operators: +, -, unary -, * and / (with a scalar, on either side for *), +=, -=, *=, /=, ==, !=, <<. All constexpr
+            Scalars are converted to T, except that integer vectors don't take floating-point scalars, as the fraction would be dropped
+        Supported functions: dot(a, b), length_squared(v), cross(a, b) for N = 3, vec_cast<U>(v) to convert components. All constexpr
+        Swizzles: swizzle<I...>(v) for any components in any order (such as swizzle<2, 1, 0>(v)), and v.xy(), v.xz(), v.yz(), v.xyz()
+        Integer vectors print as (x, y, z), and floating-point vectors as <x, y, z>
+    Point<N, T>: Another name for Vec<N, T>. Point2, Point3: Vec<2, int> and Vec<3, int>, basic 2D and 3D points (of integers)
+    Vector2, Vector3, Vector4: Vec<2, float>, Vec<3, float>, and Vec<4, float>. Also Vector3d (double), and Vector3h (_Float16, where supported)
+    Vector3: A basic 3D floating-point vector, with everything above and more
+        Supported functions: magnitude(Vector3), normalize(Vector3), angle(Vector3, Vector3)
         Supported matrix helpers: native * operator (mat*vec3), make_matrix_3x3(bool identity)
+    Matrix3, Matrix4: 3x3 and 4x4 floating-point matrices, stored contiguously in row-major order (m[row * size + column], or matrix(row, column))
+        Value types with no heap allocation, and constexpr wherever the standard library allows (everything but rotations)
+        Supported operators: * (with a matrix or a Vector3), ==, !=, <<
+        Supported functions: transpose(matrix), determinant(matrix), transform_point(Matrix4, Vector3), transform_direction(Matrix4, Vector3)
+        Builders: identity(), scaling(Vector3), rotation(Vector3 axis, float degrees), rotation_x/y/z(float degrees), Matrix4::translation(Vector3), Matrix4::from_matrix3(Matrix3)
+        Matrix3::from_nested(make_matrix_3x3()) and to_nested() convert from and to the older nested-vector matrices, transforming vectors the same way
+    Matrix: A rows x columns floating-point matrix of any size, stored contiguously in row-major order (values[row * columns + column], or matrix(row, column))
+        Converts to and from nested-vector matrices with Matrix::from_nested(nested) and to_nested()
+        Supported operators: (), <<. See matrix_multiply below
+    Vector3Array: Many Vector3 stored as a structure of arrays (x, y, and z each contiguous), for batch math with SSE/AVX (see USE_ALEXANDRIA_NO_SIMD)
+        Converts to and from std::vector<Vector3> with Vector3Array(vectors) and to_vector()
+        Supported operators: [], <<
+        Supported batch functions, each of which also has a returning version without the out argument:
+            add(a, b, out), subtract(a, b, out), scale(a, float, out), cross(a, b, out), normalize(a, out) -> Vector3Array out
+            dot(a, b, out), magnitude(a, out), angle(a, b, out) -> std::vector<float> out, where b of angle may also be a single Vector3
+        AVX is used when the compiler targets it (such as with -mavx2 or -march=native), otherwise SSE on x86, otherwise plain loops
+        Arithmetic operators: +, -, +=, -= (with a Vector3Array, or a Vector3 for every element), * and / (with a float), and unary -
+            These build an expression that is evaluated in a single pass when assigned to a Vector3Array, or with evaluate(expression, out)
+            lazy(std::vector<Vector3>) makes a std::vector<Vector3> usable with the same operators, such as evaluate(lazy(a) + lazy(b) * s, a)
+    Fast approximate math, for when a few significant digits are enough (maximum errors are listed where they are defined):
+        fast_normalize(Vector3), fast_angle(Vector3, Vector3): rsqrt with a Newton-Raphson step, and a polynomial acos. fast_magnitude(Vector3) is exact, as sqrt is already as fast
+        fast_rsqrt(float), fast_acos(float), fast_atan2(float y, float x): The approximations themselves, in radians like the std functions
+        Batch versions: fast_magnitude(a, out), fast_normalize(a, out), fast_angle(a, b, out) over Vector3Array (b may be a Vector3), and fast_atan2(y, x, out) over std::vector<float>
     Color: A small RGB 256-bit color
         Supported operators: <<
         Supported functions: to_grayscale()
@@ -104,8 +204,15 @@ Functions:
         Blank or identity 3x3 matrix creation
         returns std::vector<std::vector<float>>
     matrix_multiply(std::vector<std::vector<float>>& lhs, std::vector<std::vector<float>>& rhs)
-        Matrix multiplication
+        Matrix multiplication, converting to and from Matrix to use the fast version below
         returns std::vector<std::vector<float>>
+    transform(const Matrix3/Matrix4& matrix, const std::vector<Vector3>& vectors, std::vector<Vector3>& out, unsigned int threads = 0)
+        Applies one transform to a whole array, the same as matrix * vector for each (Matrix4 transforms points, with w = 1), into out (which may be vectors)
+        Uses SSE with the matrix held in registers, and splits arrays of TRANSFORM_PARALLEL_THRESHOLD or more across threads (0 = every hardware thread)
+        Also available for std::vector<Point3> (converted to float) and Vector3Array, and returning the output
+    matrix_multiply(const Matrix& lhs, const Matrix& rhs, Matrix& out, unsigned int threads = 0)
+        Cache-blocked SIMD matrix multiplication into out, which is resized to fit (reusing its storage) and may be either input
+        Large multiplications are split into tiles across threads (0 = every hardware thread), see the MATRIX_* settings. Also available returning the Matrix
     make_image_array(int width, int height)
         Makes and returns a blank (white) ColorAlpha array of the given dimensions
         returns std::vector<std::vector<ColorAlpha>>
@@ -185,279 +292,4903 @@ Functions:
         returns void
 
 
-Classes:
-    FastBoolGenerator: A really, really fast boolean value generator with pretty random distribution. Use () operator for use.
-    Tween: A data structure to hold and use the above easing functions to have default behavior as a basic double in range [0.0, 1.0]
-        Has built-in double casting, time stretching, and scalar output multiplication, for ease of use
-    Rect: A (x, y, w, h) structure built on and for Tweens
-        Built-in support for casting to SDL_Rect (also defines SDL_Rect struct if library is not included)
-    Circle<type>: A wrapper for std::vector that behaves as a circular buffer with a changeable zero index (moves iterator, NOT whole contents of buffer)
-        Supported operations:
-            clear, insert(element), remove: Change the contents of the buffer (at current zero index)
-            +=, -=, ++circle, circle++, --circle, circle--: Alter the position of the zero index safely, with looping. O(1)
-            []: Access the element at offset within the buffer, safely, with looping. Supports negative indexes.
-    PythonicVector<type>: A wrapper for std::vector that allows python-like indexing and slicing natively
-        Supported operations:
-            [index] (indexing): Access the element at offset within the vector. Supports negative indexes.
-            (start, end) (slicing): Access the elements between the two offsets within the vector, non-inclusive. Supports negative indexes.
+Classes:
+    FastBoolGenerator: A really, really fast boolean value generator with pretty random distribution. Use () operator for use.
+    Tween: A data structure to hold and use the above easing functions to have default behavior as a basic double in range [0.0, 1.0]
+        Has built-in double casting, time stretching, and scalar output multiplication, for ease of use
+    Rect: A (x, y, w, h) structure built on and for Tweens
+        Built-in support for casting to SDL_Rect (also defines SDL_Rect struct if library is not included)
+    Circle<type>: A wrapper for std::vector that behaves as a circular buffer with a changeable zero index (moves iterator, NOT whole contents of buffer)
+        Supported operations:
+            clear, insert(element), remove: Change the contents of the buffer (at current zero index)
+            +=, -=, ++circle, circle++, --circle, circle--: Alter the position of the zero index safely, with looping. O(1)
+            []: Access the element at offset within the buffer, safely, with looping. Supports negative indexes.
+    PythonicVector<type>: A wrapper for std::vector that allows python-like indexing and slicing natively
+        Supported operations:
+            [index] (indexing): Access the element at offset within the vector. Supports negative indexes.
+            (start, end) (slicing): Access the elements between the two offsets within the vector, non-inclusive. Supports negative indexes.
+
+--- Recently Completed And Undocumented ---
+
+--- NOW ---
+plasmamap like heatmap, or perhaps have support for custom colors in heatmap and default predefinitions for color ranges
+Add line number support to save_pdf
+
+--- Future Work ---
+Add step support for PythonicVector slicing
+A function to fetch data from a URL and return it as a string
+A reshape function for 2D/3D arrays (array -> 1D list)
+A rate-based main loop and callback strucure that can activate functions based on a rate in Hz
+Multidimensional vector extraction (copy work from HCR class)
+Simple code documentation maker (in markdown)
+Function to get a vector list in strings of all filepaths in a directory, even recursively
+A wrapper for fprintf(stdout, string, ...) just as "print()"
+A function to turn integers of a count of bytes into software/hardware KB/MB/GB summary strings
+Generalized structure message construction for serialization, network communication, events, pub/sub models, etc.
+ROS-like event-driven topic publisher and subscriber model
+A point struct and a system to iterate over certain coordinates, such as all in a circle or within a letter or the like
+a define-based system that can remove large sections of code for different debug/release compilations, such as unit tests, print statements, and anything else
+to-stream functions for all classes
+ultra-basic 2D/3D physics engine wrapper using Verlet Integration: https://www.youtube.com/watch?v=lS_qeBy3aQI
+    and friction: https://stackoverflow.com/questions/10270875/verlet-integrator-friction
+This color lookup map function: https://www.youtube.com/watch?v=HsOKwUwL1bE
+SDICL support and fast kernel interfacing
+Make the extract functions templated like the string format function
+Regular expression expansion / mapping with returned variable environment map
+Fast calculation and return of a set of points in a circle around another point (from SDL_wrapper)
+Angle calculation between three points, with one as center. Multidimensional it.
+Plotting functionality, even if basic. Save to BMP or image vector for users to display themselves.
+Serialization and un-serialization of N-dimensional vectors of basic types
+N-dimensional index to 1-dimensional index collapse
+Reading from bitmap files, even if only ones written by this file
+General-purpose raycasting structure and library, implemented to be as fast as possible
+    https://github.com/ssloy/tinyraycaster/wiki
+BigInt, like https://stackoverflow.com/questions/4507121/c-big-integer
+---
+Benched:
+Add a debug macro that just returns that string instead of printing it (requires different overloads, so tabled for now)
+Numpy-like zeros and ones functions for making vectors automatically of different shapes and sizes (return types are nightmarish)
+*/
+
+////////// SETUP //////////
+
+#define PI 3.14159265358979
+
+#define _USE_MATH_DEFINES
+#include <cmath> // Math functions, used throughout
+#include <string> // C++ string library, used throughout
+#include <vector> // C++ vector library, used throughout
+#include <map> // C++ map library, used throughout
+#include <random> // Random number generation, used only for "random" functions
+#include <iostream> // C++ stream input/output, used throughout
+#include <fstream> // C++ finestreaming, used for saving/loading functions
+#include <functional> // C++ functions-as-variables, used for some classes
+#include <stdexcept> // Clean and pretty exception throwing
+#include <iomanip> // std::setprecision
+#include <stdlib.h> // Pathnames and other utilities
+#include <cstring> // memcpy, used for color casting
+#include <cstdint> // Fixed-width integers, used throughout
+#include <typeinfo> // typeid, used for debugging macros
+#include <chrono> // Time-based functions
+#include <algorithm> // Because having a "reverse" function is handy
+#include <sstream> // String streams, used for buffering test output
+#include <thread> // Worker threads, used for parallel test cases
+#include <mutex> // Mutual exclusion, used for thread-safe test bookkeeping
+#include <atomic> // Atomic counters, used for thread-safe work distribution and test bookkeeping
+#include <memory> // Smart pointers, used for per-thread test results
+#include <type_traits> // Compile-time type checks, used for printing test values
+#include <utility> // std::declval, used for printing test values
+#include <condition_variable> // Waking background threads, used for exporting metrics and writing asynchronous logs
+#include <cstdio> // std::rename, used for replacing metrics files atomically
+#include <limits> // std::numeric_limits, used for writing metrics at full precision
+#if !defined(USE_ALEXANDRIA_NO_SIMD) && defined(__AVX__)
+#define ALEXANDRIA_AVX_AVAILABLE // Only defined when the compiler targets AVX (such as with -mavx2 or -march=native), which also implies SSE
+#define ALEXANDRIA_SSE_AVAILABLE
+#include <immintrin.h> // AVX and SSE intrinsics, used for batch math kernels
+#elif !defined(USE_ALEXANDRIA_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ALEXANDRIA_SSE_AVAILABLE // Only defined when the compiler targets SSE2, which every x86-64 compiler does by default
+#include <emmintrin.h> // SSE intrinsics, used for batch math kernels
+#endif
+#if defined(USE_ALEXANDRIA_TSC) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define ALEXANDRIA_TSC_AVAILABLE // Only defined when the timestamp counter can actually be read
+#ifdef _MSC_VER
+#include <intrin.h> // __rdtsc, __rdtscp, and __cpuid, used for cycle-accurate timing
+#else
+#include <x86intrin.h> // __rdtsc and __rdtscp, used for cycle-accurate timing
+#include <cpuid.h> // __get_cpuid, used to check for an invariant timestamp counter
+#endif
+#endif
+#ifdef USE_ALEXANDRIA_ALLOC_TRACKING
+#include <new> // std::bad_alloc and std::nothrow_t, used for replacing operator new
+#include <cstddef> // std::max_align_t, used for aligning tracked allocations
+#endif
+#if defined(USE_ALEXANDRIA_FLIGHT_RECORDER) && !defined(_WIN32)
+#define ALEXANDRIA_FLIGHT_RECORDER_SIGNALS // Only defined when crash signals can be caught with sigaction
+#include <csignal> // sigaction and raise, used for dumping the flight recorder on a crash
+#include <fcntl.h> // open, used for dumping the flight recorder on a crash
+#include <unistd.h> // write and close, used for dumping the flight recorder on a crash
+#endif
+#if defined(USE_ALEXANDRIA_PERF_COUNTERS) && defined(__linux__)
+#define ALEXANDRIA_PERF_AVAILABLE // Only defined when perf_event counters can actually be opened
+#include <linux/perf_event.h> // perf_event_attr, used for hardware counters
+#include <sys/syscall.h> // SYS_perf_event_open, which has no libc wrapper
+#include <unistd.h> // syscall, read, and close, used for hardware counters
+#endif
+
+
+////////// MACROS //////////
+#ifndef USE_ALEXANDRIA_COLORLESS
+// Terminal colors (source: https://www.lihaoyi.com/post/BuildyourownCommandLinewithANSIescapecodes.html)
+#define T_RESET "\e[0m"
+// Terminal Foreground Colors
+#define T_BLACK "\e[30m"
+#define T_RED "\e[31m"
+#define T_GREEN "\e[32m" // equivalently "\e[0;32m"
+#define T_YELLOW "\e[33m"
+#define T_BLUE "\e[34m"
+#define T_MAGENTA "\e[35m"
+#define T_CYAN "\e[36m"
+#define T_WHITE "\e[37m"
+// Terminal Background Colors
+#define TB_BLACK "\e[40m"
+#define TB_RED "\e[41m"
+#define TB_GREEN "\e[42m"
+#define TB_YELLOW "\e[43m"
+#define TB_BLUE "\e[44m"
+#define TB_MAGENTA "\e[45m"
+#define TB_CYAN "\e[36m"
+#define TB_WHITE "\e[37m"
+#else // Below is placeholder values for colorless compilation
+#define T_RESET ""
+#define T_BLACK ""
+#define T_RED ""
+#define T_GREEN ""
+#define T_YELLOW ""
+#define T_BLUE ""
+#define T_MAGENTA ""
+#define T_CYAN ""
+#define T_WHITE ""
+// Terminal Background Colors
+#define TB_BLACK ""
+#define TB_RED ""
+#define TB_GREEN ""
+#define TB_YELLOW ""
+#define TB_BLUE ""
+#define TB_MAGENTA ""
+#define TB_CYAN ""
+#define TB_WHITE ""
+#endif
+
+// A "filename:line:function" position in the source code, built only from compile-time constants so that capturing one never allocates
+// See SOURCE_LOCATION below, and LOCATION for the std::string equivalent
+struct SourceLocation {
+    const char* file;
+    unsigned int line;
+    const char* function;
+};
+
+// SourceLocation streaming/printing, in the same format as LOCATION
+std::ostream& operator << (std::ostream& out, const SourceLocation& rhs) {
+    out << rhs.file << ":" << rhs.line << ":" << rhs.function;
+    return out;
+}
+
+// Returns a SourceLocation as a std::string, in the same format as LOCATION
+std::string to_string(const SourceLocation& location) {
+    return (std::string)location.file + ":" + std::to_string(location.line) + ":" + location.function;
+}
+
+// Debugging macros
+#define INFO(x) std::cout << #x << " @ " << &x <<  " (" << typeid(x).name() << ") = " << x << std::endl;
+#define INFO_NOVALUE(x) std::cout << #x << " @ " << &x << " (" << typeid(x).name() << ")" << std::endl;
+#define INFO_BASIC(x) std::cout << #x << " (" << typeid(x).name() << ")" << std::endl;
+#define LOCATION (std::string)__FILE__ + ":" + std::to_string(__LINE__) + ":" + (std::string)__func__
+#define SOURCE_LOCATION (SourceLocation{__FILE__, __LINE__, __func__})
+#define COMPILE_TIME (std::string)(__TIME__) + " on " + (std::string)(__DATE__)
+
+// Unique identifier helpers, for macros that declare their own variables or functions
+#define ALEXANDRIA_CONCAT_INNER(a, b) a##b
+#define ALEXANDRIA_CONCAT(a, b) ALEXANDRIA_CONCAT_INNER(a, b)
+
+// Debug printing macros
+#define PRINT_VECTOR(x) std::cout << #x << " = "; for (auto i : x) { std::cout << i << " "; } std::cout << std::endl;
+
+// Log levels, from most to least severe. A message prints only if its level is at or below both the compiled and its module's runtime level
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_PASS 3
+#define LOG_LEVEL_LOG 4
+
+// Log level settings, each of which may be defined before including this file to override it
+#ifndef LOG_LEVEL_COMPILED
+#define LOG_LEVEL_COMPILED LOG_LEVEL_LOG // Messages above this level are compiled out entirely
+#endif
+#ifndef LOG_LEVEL_DEFAULT
+#define LOG_LEVEL_DEFAULT LOG_LEVEL_LOG // Starting runtime level of every LogModule
+#endif
+
+// A named group of log messages sharing a runtime level, such as a subsystem of a program
+// Messages go to the module named by ALEXANDRIA_LOG_MODULE where they are written, which can be redefined around a section of code
+class LogModule {
+public:
+    explicit LogModule(const char* module_name, int module_level = LOG_LEVEL_DEFAULT);
+    LogModule(const LogModule&) = delete;
+    LogModule& operator=(const LogModule&) = delete;
+
+    const char* name;
+    std::atomic<int> level; // Relaxed, as a level change only has to be seen eventually
+};
+
+std::mutex LOG_MODULES_MUTEX; // Guards the list of log modules
+
+// Returns every log module that has been constructed
+std::vector<LogModule*>& log_modules() {
+    static std::vector<LogModule*> modules;
+    return modules;
+}
+
+LogModule::LogModule(const char* module_name, int module_level) : name(module_name), level(module_level) {
+    std::lock_guard<std::mutex> lock(LOG_MODULES_MUTEX);
+    log_modules().push_back(this);
+}
+
+LogModule LOG_MODULE_DEFAULT("default"); // Where messages go unless ALEXANDRIA_LOG_MODULE is redefined
+#ifndef ALEXANDRIA_LOG_MODULE
+#define ALEXANDRIA_LOG_MODULE LOG_MODULE_DEFAULT
+#endif
+
+// Whether a message of a level would print in a module. The first comparison is constant, so compiled-out levels cost nothing
+inline bool log_enabled(const LogModule& module, int level) {
+    return level <= LOG_LEVEL_COMPILED && level <= module.level.load(std::memory_order_relaxed);
+}
+
+// Sets the runtime level of the default module
+void log_set_level(int level) {
+    LOG_MODULE_DEFAULT.level.store(level, std::memory_order_relaxed);
+}
+
+// Sets the runtime level of every module of a name, returning false if there are none
+bool log_set_level(const std::string& module_name, int level) {
+    std::lock_guard<std::mutex> lock(LOG_MODULES_MUTEX);
+    bool found = false;
+    for (LogModule* module : log_modules()) {
+        if (module_name == module->name) {
+            module->level.store(level, std::memory_order_relaxed);
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Warning rate limit settings, each of which may be defined before including this file to override them
+#ifndef WARNING_RATE_LIMIT_FIRST
+#define WARNING_RATE_LIMIT_FIRST 10 // Each WARNING(x) prints its first this many messages...
+#endif
+#ifndef WARNING_RATE_LIMIT_EVERY
+#define WARNING_RATE_LIMIT_EVERY 1000 // ...then only every this many-th, noting how many were suppressed in between. 1 never suppresses
+#endif
+
+// The count of messages reaching one rate-limited call site. Constant-initialized, so a function-local static of it needs no guard
+struct LogRateLimit {
+    constexpr LogRateLimit(const SourceLocation& site_location) : location(site_location) {}
+
+    SourceLocation location;
+    std::atomic<unsigned long long> count{0};
+    std::atomic<unsigned long long> summarized{0}; // Messages before this one were already counted by log_rate_limit_summary()
+};
+
+// How many messages of a call site were suppressed before the one being printed, printed as a note after it if any were
+// Suppressed messages are only counted, not compared, so they may well differ from the one printed
+struct LogSuppressed {
+    unsigned long long count;
+};
+
+// LogSuppressed streaming/printing
+std::ostream& operator << (std::ostream& out, const LogSuppressed& rhs) {
+    if (rhs.count > 0) {
+        out << " (suppressed " << rhs.count << " messages from this call site since the last printed)";
+    }
+    return out;
+}
+
+// Adds a call site to those summarized by log_rate_limit_summary(), once it first suppresses a message
+void log_rate_limit_enroll(LogRateLimit& limit);
+
+// Counts a message at a rate-limited call site, returning whether it should print: the first WARNING_RATE_LIMIT_FIRST, then every WARNING_RATE_LIMIT_EVERY-th
+inline bool log_rate_limit(LogRateLimit& limit, LogSuppressed& suppressed) {
+    unsigned long long index = limit.count.fetch_add(1, std::memory_order_relaxed);
+    if (index < WARNING_RATE_LIMIT_FIRST) {
+        suppressed.count = 0;
+        return true;
+    }
+    if (index == WARNING_RATE_LIMIT_FIRST) {
+        log_rate_limit_enroll(limit);
+    }
+    if ((index - WARNING_RATE_LIMIT_FIRST + 1) % WARNING_RATE_LIMIT_EVERY != 0) {
+        return false;
+    }
+    // Suppressed since the last printed message, WARNING_RATE_LIMIT_EVERY before this one, except for those already summarized
+    unsigned long long first = std::max(index + 1 - WARNING_RATE_LIMIT_EVERY, limit.summarized.load(std::memory_order_relaxed));
+    suppressed.count = index > first ? index - first : 0;
+    return true;
+}
+
+// Debug logging macros, only actually print if DEBUG is defined and their level is enabled in the current module
+// The level is checked before x is evaluated or anything is formatted, so a filtered message costs a load and a branch
+// Every configuration expands to one complete statement taking no semicolon, so if (c) LOG("a") else LOG("b") compiles in all of them
+#if defined(DEBUG) && defined(USE_ALEXANDRIA_BINARY_LOG)
+#define LOG_WRITE_IMPL(level, prefix, x) static const BinaryLogFormat alexandria_log_format(level, SOURCE_LOCATION); binary_log_begin(alexandria_log_format) << x; binary_log_end();
+#elif defined(DEBUG) && defined(USE_ALEXANDRIA_ASYNC_LOG)
+#define LOG_WRITE_IMPL(level, prefix, x) log_submit(log_begin() << prefix << x << '\n');
+#elif defined(DEBUG)
+#define LOG_WRITE_IMPL(level, prefix, x) std::cout << prefix << x << std::endl;
+#endif
+#ifdef USE_ALEXANDRIA_FLIGHT_RECORDER
+#define LOG_RECORD_IMPL(level, x) flight_record(level, SOURCE_LOCATION, #x),
+#else
+#define LOG_RECORD_IMPL(level, x)
+#endif
+#ifdef DEBUG
+#define LOG_MESSAGE_IMPL(level, prefix, x) if (LOG_RECORD_IMPL(level, x) !log_enabled(ALEXANDRIA_LOG_MODULE, level)) {} else {LOG_WRITE_IMPL(level, prefix, x)}
+#define LOG_LIMITED_MESSAGE_IMPL(level, prefix, x) if (LOG_RECORD_IMPL(level, x) !log_enabled(ALEXANDRIA_LOG_MODULE, level)) {} else {static LogRateLimit alexandria_rate_limit(SOURCE_LOCATION); LogSuppressed alexandria_suppressed; if (log_rate_limit(alexandria_rate_limit, alexandria_suppressed)) {LOG_WRITE_IMPL(level, prefix, x << alexandria_suppressed)}}
+#elif defined(USE_ALEXANDRIA_FLIGHT_RECORDER)
+#define LOG_MESSAGE_IMPL(level, prefix, x) flight_record(level, SOURCE_LOCATION, #x);
+#define LOG_LIMITED_MESSAGE_IMPL(level, prefix, x) flight_record(level, SOURCE_LOCATION, #x);
+#else
+#define LOG_MESSAGE_IMPL(level, prefix, x) {}
+#define LOG_LIMITED_MESSAGE_IMPL(level, prefix, x) {}
+#endif
+#define LOG(x) LOG_MESSAGE_IMPL(LOG_LEVEL_LOG, T_BLUE << "LOG: " << T_RESET, x)
+#define PASS(x) LOG_MESSAGE_IMPL(LOG_LEVEL_PASS, T_GREEN << "PASS: " << T_RESET, x)
+#define WARNING(x) LOG_LIMITED_MESSAGE_IMPL(LOG_LEVEL_WARNING, T_YELLOW << "WARNING: " << T_RESET, x)
+#define ERROR(x) LOG_MESSAGE_IMPL(LOG_LEVEL_ERROR, T_RED << "ERROR: " << T_RESET, x)
+
+// Testing macros
+// A count of tests, summed from every thread's results whenever it is read (see TestResults), so that it is always current
+//  while tests on different threads never share a counter. Assigning to it, such as TESTS_TOTAL = 0, counts on from that value
+class TestCount {
+public:
+    explicit TestCount(bool count_successful) : successful(count_successful) {}
+
+    operator unsigned int() const {
+        return sum() - offset;
+    }
+    TestCount& operator = (unsigned int value) {
+        offset = sum() - value;
+        return *this;
+    }
+
+private:
+    unsigned int sum() const;
+
+    bool successful; // Whether this counts only successful tests, or all of them
+    unsigned int offset = 0;
+};
+
+TestCount TESTS_TOTAL(false);
+TestCount TESTS_SUCCESSFUL(true);
+bool TESTS_SILENT = false; // If set true, tests other than summary will have no output
+std::vector<std::string> TESTS_FAILURES; // Appended to directly by failing tests, under TESTS_FAILURES_MUTEX
+std::mutex TESTS_FAILURES_MUTEX;
+std::mutex TESTS_OUTPUT_MUTEX; // Guards std::cout while a block of buffered test output is written
+
+// Number of bytes of test output buffered per thread before it is written out
+#define TESTS_OUTPUT_CAPACITY 65536
+
+// Buffered, per-thread destination for test output
+// Output is written to std::cout in whole blocks rather than flushed on every test, and only on overflow, failure, end of a test case, or TEST_SUMMARY()
+class TestSink {
+public:
+    TestSink() {
+        buffer.reserve(TESTS_OUTPUT_CAPACITY);
+    }
+    ~TestSink() {
+        flush();
+    }
+
+    // Text and locations are appended directly, so that printing a passed test never allocates
+    TestSink& operator << (const char* text) {
+        buffer += text;
+        return *this;
+    }
+    TestSink& operator << (char c) {
+        buffer += c;
+        return *this;
+    }
+    TestSink& operator << (const std::string& text) {
+        buffer += text;
+        return *this;
+    }
+    TestSink& operator << (const SourceLocation& location) {
+        buffer += location.file;
+        buffer += ':';
+        append_unsigned(location.line);
+        buffer += ':';
+        buffer += location.function;
+        return *this;
+    }
+
+    // Anything else is formatted through a stream, which is only used when printing values of failed tests
+    template <typename T>
+    TestSink& operator << (const T& value) {
+        std::ostringstream formatted;
+        formatted << value;
+        buffer += formatted.str();
+        return *this;
+    }
+
+    // Writes the buffer out only if it has grown past TESTS_OUTPUT_CAPACITY
+    void commit() {
+        if (buffer.size() >= TESTS_OUTPUT_CAPACITY) {
+            flush();
+        }
+    }
+
+    // Writes the buffer out as one block, keeping its capacity for reuse
+    void flush() {
+        if (buffer.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(TESTS_OUTPUT_MUTEX);
+        std::cout.write(buffer.data(), buffer.size());
+        std::cout.flush();
+        buffer.clear();
+    }
+
+private:
+    // Appends an unsigned integer without going through a stream or a temporary string
+    void append_unsigned(unsigned int value) {
+        char digits[16];
+        int count = 0;
+        do {
+            digits[count++] = '0' + (value % 10);
+            value /= 10;
+        } while (value);
+        while (count) {
+            buffer += digits[--count];
+        }
+    }
+
+    std::string buffer;
+};
+
+thread_local TestSink TESTS_OUTPUT; // Where test output is sent, one per thread so output never interleaves mid-line
+
+// Per-thread test counts, so tests on different threads never share a counter or a lock. Summed by reading TESTS_TOTAL and TESTS_SUCCESSFUL
+struct TestResults {
+    std::atomic<unsigned int> total{0}; // Only ever written by the owning thread
+    std::atomic<unsigned int> successful{0}; // Only ever written by the owning thread
+    char padding[64]; // Keeps the counters of separately allocated results off of each other's cache lines
+};
+
+std::mutex TESTS_RESULTS_MUTEX; // Guards the list of per-thread results, taken once per thread and on collection
+
+// Returns the per-thread results of every thread that has ever run a test
+// Results are never freed, so tests from threads that have since exited still count
+std::vector<std::unique_ptr<TestResults>>& test_results_registry() {
+    static std::vector<std::unique_ptr<TestResults>> registry;
+    return registry;
+}
+
+// Returns the results of the calling thread, registering them on first use
+TestResults& test_local_results() {
+    thread_local TestResults* local = nullptr;
+    if (local == nullptr) {
+        std::lock_guard<std::mutex> lock(TESTS_RESULTS_MUTEX);
+        test_results_registry().emplace_back(new TestResults());
+        local = test_results_registry().back().get();
+    }
+    return *local;
+}
+
+// Records a passed test, safe to call from any thread
+void test_record_pass() {
+    TestResults& results = test_local_results();
+    // Single writer, so a relaxed load and store is enough and avoids a locked read-modify-write
+    results.total.store(results.total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    results.successful.store(results.successful.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// Records a failed test by its location (and name), safe to call from any thread
+void test_record_failure(const std::string& failure) {
+    TestResults& results = test_local_results();
+    results.total.store(results.total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(TESTS_FAILURES_MUTEX);
+    TESTS_FAILURES.push_back(failure);
+}
+
+// The optional name of a test, held as a plain pointer so that naming a test costs nothing unless it fails
+struct TestName {
+    TestName() : text(nullptr) {}
+    TestName(const char* name) : text(name) {}
+    TestName(const std::string& name) : text(name.c_str()) {}
+    const char* text;
+};
+
+// Records and prints a passed test. Never allocates or flushes
+void test_pass(const SourceLocation& location, TestName name) {
+    test_record_pass();
+    if (!TESTS_SILENT) {
+        if (name.text) {
+            TESTS_OUTPUT << T_GREEN << "test \"" << name.text << "\" passed @ " << location << T_RESET << '\n';
+        } else {
+            TESTS_OUTPUT << T_GREEN << "test passed @ " << location << T_RESET << '\n';
+        }
+        TESTS_OUTPUT.commit();
+    }
+}
+
+// Records and prints the header of a failed test. This is the only place the failure strings are built
+// The caller follows up with the details of the failure, then flushes TESTS_OUTPUT
+void test_fail(const SourceLocation& location, TestName name) {
+    if (name.text) {
+        test_record_failure(to_string(location) + " (" + name.text + ")");
+        if (!TESTS_SILENT) {
+            TESTS_OUTPUT << T_RED << "TEST \"" << name.text << "\" FAILED @ " << location << T_RESET << '\n';
+        }
+    } else {
+        test_record_failure(to_string(location));
+        if (!TESTS_SILENT) {
+            TESTS_OUTPUT << T_RED << "TEST FAILED @ " << location << T_RESET << '\n';
+        }
+    }
+}
+
+// Sums the per-thread counts of all threads, including those that have exited
+unsigned int TestCount::sum() const {
+    std::lock_guard<std::mutex> lock(TESTS_RESULTS_MUTEX);
+    unsigned int result = 0;
+    for (const std::unique_ptr<TestResults>& results : test_results_registry()) {
+        result += (successful ? results->successful : results->total).load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+// Whether a value can be printed with <<, so that failed tests can still report on values of types without a stream operator
+template <typename T>
+class TestIsStreamable {
+    template <typename U>
+    static auto check(int) -> decltype(std::declval<std::ostream&>() << std::declval<const U&>(), std::true_type());
+    template <typename U>
+    static std::false_type check(...);
+public:
+    static const bool value = decltype(check<T>(0))::value;
+};
+
+// Prints a value of a failed test, or "{?}" if it has no stream operator
+template <typename T>
+typename std::enable_if<TestIsStreamable<T>::value>::type test_print_value(const T& value) {
+    TESTS_OUTPUT << value;
+}
+template <typename T>
+typename std::enable_if<!TestIsStreamable<T>::value>::type test_print_value(const T&) {
+    TESTS_OUTPUT << "{?}";
+}
+
+// A decomposed comparison in a test expression, such as the "x < y" of TEST(x < y)
+// Both operands have been evaluated exactly once, and are only referenced (and printed) if the test fails
+template <typename L, typename R>
+struct TestBinaryExpression {
+    const L& lhs;
+    const R& rhs;
+    bool result;
+    const char* op;
+
+    // Allows && and || after a comparison, at the cost of no longer decomposing the expression
+    explicit operator bool() const {return result;}
+};
+
+// The comparisons below run inside templates, where a signed operand compared to an unsigned one (such as TEST(v.size() == 3)) would warn about
+//  a literal that the test's own line never compares directly, so -Wsign-compare is silenced up to test_epsilon, as Catch does
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#endif
+
+// The left-hand operand of a test expression, captured before any comparison is applied to it
+// Test expressions are captured as "TestDecomposer() <= x", which binds to the first operand of x because <= binds tighter than == and != and
+//  evaluates left to right with <, >, and >=. Parenthesize anything using ?: or = in a test
+template <typename L>
+struct TestExpressionLhs {
+    const L& lhs;
+
+    template <typename R> TestBinaryExpression<L, R> operator == (const R& rhs) const {return {lhs, rhs, static_cast<bool>(lhs == rhs), "=="};}
+    template <typename R> TestBinaryExpression<L, R> operator != (const R& rhs) const {return {lhs, rhs, static_cast<bool>(lhs != rhs), "!="};}
+    template <typename R> TestBinaryExpression<L, R> operator < (const R& rhs) const {return {lhs, rhs, static_cast<bool>(lhs < rhs), "<"};}
+    template <typename R> TestBinaryExpression<L, R> operator <= (const R& rhs) const {return {lhs, rhs, static_cast<bool>(lhs <= rhs), "<="};}
+    template <typename R> TestBinaryExpression<L, R> operator > (const R& rhs) const {return {lhs, rhs, static_cast<bool>(lhs > rhs), ">"};}
+    template <typename R> TestBinaryExpression<L, R> operator >= (const R& rhs) const {return {lhs, rhs, static_cast<bool>(lhs >= rhs), ">="};}
+
+    // Bitwise operators bind looser than comparisons, so they reach here and are simply applied
+    template <typename R> auto operator & (const R& rhs) const -> decltype(std::declval<const L&>() & rhs) {return lhs & rhs;}
+    template <typename R> auto operator | (const R& rhs) const -> decltype(std::declval<const L&>() | rhs) {return lhs | rhs;}
+    template <typename R> auto operator ^ (const R& rhs) const -> decltype(std::declval<const L&>() ^ rhs) {return lhs ^ rhs;}
+
+    // Allows && and || in tests, at the cost of no longer decomposing the expression
+    explicit operator bool() const {return static_cast<bool>(lhs);}
+};
+
+// Starts the capture of a test expression, see TestExpressionLhs
+struct TestDecomposer {
+    template <typename L>
+    TestExpressionLhs<L> operator <= (const L& lhs) const {return {lhs};}
+};
+
+// Checks a test expression that was a single value, such as TEST(flag)
+template <typename L>
+void test_check(const SourceLocation& location, TestName name, const char* text, const TestExpressionLhs<L>& expression) {
+    if (static_cast<bool>(expression.lhs)) {
+        test_pass(location, name);
+    } else {
+        test_fail(location, name);
+        if (!TESTS_SILENT) {
+            TESTS_OUTPUT << "\twhere " << text << " (";
+            test_print_value(expression.lhs);
+            TESTS_OUTPUT << ") was FALSE\n";
+            TESTS_OUTPUT.flush();
+        }
+    }
+}
+
+// Checks a test expression that was a comparison, such as TEST(x < y), printing both operands on failure
+template <typename L, typename R>
+void test_check(const SourceLocation& location, TestName name, const char* text, const TestBinaryExpression<L, R>& expression) {
+    if (expression.result) {
+        test_pass(location, name);
+    } else {
+        test_fail(location, name);
+        if (!TESTS_SILENT) {
+            TESTS_OUTPUT << "\twhere " << text << " (";
+            test_print_value(expression.lhs);
+            TESTS_OUTPUT << " " << expression.op << " ";
+            test_print_value(expression.rhs);
+            TESTS_OUTPUT << ") was FALSE\n";
+            TESTS_OUTPUT.flush();
+        }
+    }
+}
+
+// Checks any other test expression, such as the result of && or ||
+template <typename T>
+void test_check(const SourceLocation& location, TestName name, const char* text, const T& value) {
+    if (static_cast<bool>(value)) {
+        test_pass(location, name);
+    } else {
+        test_fail(location, name);
+        if (!TESTS_SILENT) {
+            TESTS_OUTPUT << "\twhere " << text << " (";
+            test_print_value(value);
+            TESTS_OUTPUT << ") was FALSE\n";
+            TESTS_OUTPUT.flush();
+        }
+    }
+}
+
+// Prints the details of a failed comparison between two test values
+template <typename X, typename Y>
+void test_print_comparison(const char* verb, const char* x_text, const char* y_text, const X& x, const Y& y) {
+    TESTS_OUTPUT << "\t" << verb << " " << x_text << " (";
+    test_print_value(x);
+    TESTS_OUTPUT << ") to " << y_text << " (";
+    test_print_value(y);
+    TESTS_OUTPUT << ")";
+}
+
+// Checks x == y, with each operand evaluated exactly once by the caller
+template <typename X, typename Y>
+void test_equal(const SourceLocation& location, TestName name, const char* x_text, const char* y_text, const X& x, const Y& y) {
+    if (x == y) {
+        test_pass(location, name);
+    } else {
+        test_fail(location, name);
+        if (!TESTS_SILENT) {
+            test_print_comparison("equating", x_text, y_text, x, y);
+            TESTS_OUTPUT << '\n';
+            TESTS_OUTPUT.flush();
+        }
+    }
+}
+
+// Checks x != y, with each operand evaluated exactly once by the caller
+template <typename X, typename Y>
+void test_not_equal(const SourceLocation& location, TestName name, const char* x_text, const char* y_text, const X& x, const Y& y) {
+    if (x != y) {
+        test_pass(location, name);
+    } else {
+        test_fail(location, name);
+        if (!TESTS_SILENT) {
+            test_print_comparison("inequating", x_text, y_text, x, y);
+            TESTS_OUTPUT << '\n';
+            TESTS_OUTPUT.flush();
+        }
+    }
+}
+
+// Checks whether abs(x - y) <= e matches within, with each operand evaluated exactly once by the caller
+template <typename X, typename Y, typename E>
+void test_epsilon(const SourceLocation& location, const char* x_text, const char* y_text, const X& x, const Y& y, const E& e, bool within) {
+    using std::abs;
+    if ((abs(x - y) <= e) == within) {
+        test_pass(location, TestName());
+    } else {
+        test_fail(location, TestName());
+        if (!TESTS_SILENT) {
+            test_print_comparison(within ? "equating" : "inequating", x_text, y_text, x, y);
+            TESTS_OUTPUT << " with epsilon ";
+            test_print_value(e);
+            TESTS_OUTPUT << '\n';
+            TESTS_OUTPUT.flush();
+        }
+    }
+}
+
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+// A registered test case, see TEST_CASE(n) below
+struct TestCase {
+    std::string name;
+    std::string location;
+    void (*function)();
+};
+
+// Returns the list of all registered test cases, in registration order
+std::vector<TestCase>& test_case_registry() {
+    static std::vector<TestCase> registry; // Function-local so it exists before any static registrar runs
+    return registry;
+}
+
+// Registers a test case on construction, used as a static object by TEST_CASE(n)
+struct TestCaseRegistrar {
+    TestCaseRegistrar(const std::string& name, const std::string& location, void (*function)()) {
+        test_case_registry().push_back({name, location, function});
+    }
+};
+
+// Runs every registered test case across a pool of threads, merging results into the TEST_SUMMARY() bookkeeping
+// Output of each case is buffered and printed as one block (unless it overflows TESTS_OUTPUT_CAPACITY), so cases don't interleave their lines
+void run_test_cases(unsigned int thread_count = std::thread::hardware_concurrency()) {
+    std::vector<TestCase>& cases = test_case_registry();
+    if (thread_count == 0) {
+        thread_count = 1; // hardware_concurrency() may return 0 if unknown
+    }
+    if (thread_count > cases.size()) {
+        thread_count = cases.size();
+    }
+
+    std::atomic<size_t> next_case(0); // Index of the next case to be picked up by a free worker
+    auto worker = [&]() {
+        for (size_t i = next_case++; i < cases.size(); i = next_case++) {
+            try {
+                cases[i].function();
+            } catch (const std::exception& e) {
+                test_record_failure(cases[i].location + " (" + cases[i].name + ")");
+                TESTS_OUTPUT << T_RED << "TEST CASE \"" << cases[i].name << "\" THREW @ " << cases[i].location << T_RESET << "\n\t" << e.what() << '\n';
+            } catch (...) {
+                test_record_failure(cases[i].location + " (" + cases[i].name + ")");
+                TESTS_OUTPUT << T_RED << "TEST CASE \"" << cases[i].name << "\" THREW @ " << cases[i].location << T_RESET << "\n\tunknown exception\n";
+            }
+            TESTS_OUTPUT.flush(); // Print this case's output as one block
+        }
+    };
+
+    // The calling thread works alongside the pool instead of idling
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < thread_count; t++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
+
+// Silences the "suggest parentheses" warnings that the expression capture of TEST(x) causes on GCC and Clang
+#ifdef __GNUC__
+#define TEST_DECOMPOSE_BEGIN _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wparentheses\"")
+#define TEST_DECOMPOSE_END _Pragma("GCC diagnostic pop")
+#else
+#define TEST_DECOMPOSE_BEGIN
+#define TEST_DECOMPOSE_END
+#endif
+
+#define TEST_CASE_IMPL(n, f) static void f(); static TestCaseRegistrar ALEXANDRIA_CONCAT(f, _registrar)(n, (std::string)__FILE__ + ":" + std::to_string(__LINE__), &f); static void f()
+
+#define TEST(x) TEST_DECOMPOSE_BEGIN test_check(SOURCE_LOCATION, TestName(), #x, TestDecomposer() <= x); TEST_DECOMPOSE_END
+#define TEST_NAMED(n, x) TEST_DECOMPOSE_BEGIN test_check(SOURCE_LOCATION, n, #x, TestDecomposer() <= x); TEST_DECOMPOSE_END
+#define TEST_EQ(x, y) test_equal(SOURCE_LOCATION, TestName(), #x, #y, x, y);
+#define TEST_NAMED_EQ(n, x, y) test_equal(SOURCE_LOCATION, n, #x, #y, x, y);
+#define TEST_EPSILON_EQ(x, y, e) test_epsilon(SOURCE_LOCATION, #x, #y, x, y, e, true);
+#define TEST_NEQ(x, y) test_not_equal(SOURCE_LOCATION, TestName(), #x, #y, x, y);
+#define TEST_NAMED_NEQ(n, x, y) test_not_equal(SOURCE_LOCATION, n, #x, #y, x, y);
+#define TEST_EPSILON_NEQ(x, y, e) test_epsilon(SOURCE_LOCATION, #x, #y, x, y, e, false);
+#define TEST_CASE(n) TEST_CASE_IMPL(n, ALEXANDRIA_CONCAT(alexandria_test_case_, __LINE__))
+#define RUN_TEST_CASES() run_test_cases();
+#define TESTS_FLUSH() TESTS_OUTPUT.flush();
+#define TEST_SUMMARY() TESTS_FLUSH() std::cout << T_CYAN << "+--------------+\n| TEST SUMMARY |\n+--------------+\n" << T_GREEN << "Passed " << TESTS_SUCCESSFUL << "/" << TESTS_TOTAL << " tests (" << (TESTS_SUCCESSFUL/(float)TESTS_TOTAL)*100.0 << "%)" << T_RESET << std::endl; if (TESTS_FAILURES.size() > 0) {std::cout << T_RED << "Failed tests:" << T_RESET << std::endl; for (const std::string& s : TESTS_FAILURES) {std::cout << "    " << s << std::endl;}}
+
+// Other Macros
+#define TIME(x) {TimedSection alexandria_timed_section(SOURCE_LOCATION); x; alexandria_timed_section.end();}
+#define TIME_NAMED(n, x) {TimedSection alexandria_timed_section(n, SOURCE_LOCATION); x; alexandria_timed_section.end();}
+
+// Benchmarking settings, each of which may be defined before including this file to override it
+#ifndef BENCH_WARMUP_NS
+#define BENCH_WARMUP_NS 50000000 // Minimum time spent running a benchmark before it is measured, also used to calibrate the iterations per sample
+#endif
+#ifndef BENCH_SAMPLE_NS
+#define BENCH_SAMPLE_NS 1000000 // Target duration of one timed sample, iterations per sample are chosen to reach this
+#endif
+#ifndef BENCH_SAMPLES
+#define BENCH_SAMPLES 100 // Number of timed samples taken per benchmark
+#endif
+#ifndef BENCH_MAX_NS
+#define BENCH_MAX_NS 2000000000 // Sampling stops early once this much time has been spent, as long as at least 10 samples were taken
+#endif
+
+// Keeps the compiler from optimizing away a value, or the work done to produce it, in benchmarks
+template <typename T>
+inline void do_not_optimize(const T& value) {
+#ifdef __GNUC__
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static const volatile void* escape;
+    escape = &value;
+#endif
+}
+
+// Calls a benchmarked function, keeping its result (if any) from being optimized away
+template <typename F>
+inline void bench_invoke(F& function, std::true_type) {
+    function();
+}
+template <typename F>
+inline void bench_invoke(F& function, std::false_type) {
+    do_not_optimize(function());
+}
+
+// Statistics of a benchmark, all times are per iteration
+struct BenchResult {
+    std::string name;
+    std::string location;
+    unsigned long long iterations; // Iterations per sample
+    unsigned int samples;
+    double min_ns;
+    double median_ns;
+    double p99_ns;
+    double mean_ns;
+    double bytes_per_second; // From the median, 0 if no byte count was given
+    double items_per_second; // From the median, 0 if no item count was given
+};
+
+// Formats a number of nanoseconds with a sensible unit, such as "12.3ns" or "4.56ms"
+std::string bench_format_ns(double ns) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(ns < 10.0 ? 2 : 1);
+    if (ns < 1e3) {
+        out << ns << "ns";
+    } else if (ns < 1e6) {
+        out << ns / 1e3 << "us";
+    } else if (ns < 1e9) {
+        out << ns / 1e6 << "ms";
+    } else {
+        out << ns / 1e9 << "s";
+    }
+    return out.str();
+}
+
+// Formats a per-second rate with a metric prefix, such as "1.23 GB/s"
+std::string bench_format_rate(double per_second, const std::string& unit) {
+    const char* prefixes[] = {"", "K", "M", "G", "T"};
+    int prefix = 0;
+    while (per_second >= 1000.0 && prefix < 4) {
+        per_second /= 1000.0;
+        prefix++;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2) << per_second << " " << prefixes[prefix] << unit << "/s";
+    return out.str();
+}
+
+// BenchResult streaming/printing, in the same style as the TIME macros
+std::ostream& operator << (std::ostream& out, const BenchResult& rhs) {
+    out << T_CYAN << "Benchmark \"" << rhs.name << "\" @ " << rhs.location << ": " << T_GREEN
+        << "min " << bench_format_ns(rhs.min_ns) << ", median " << bench_format_ns(rhs.median_ns) << ", p99 " << bench_format_ns(rhs.p99_ns) << T_CYAN
+        << " (" << rhs.samples << " samples of " << rhs.iterations << " iterations)";
+    if (rhs.bytes_per_second > 0.0) {
+        out << " " << T_GREEN << bench_format_rate(rhs.bytes_per_second, "B") << T_CYAN;
+    }
+    if (rhs.items_per_second > 0.0) {
+        out << " " << T_GREEN << bench_format_rate(rhs.items_per_second, "items") << T_CYAN;
+    }
+    out << T_RESET;
+    return out;
+}
+
+// Benchmarks a function: warms it up, calibrates how many iterations make up a BENCH_SAMPLE_NS sample, then times BENCH_SAMPLES samples
+// bytes and items are the amount processed by one call, and are used to report throughput if non-zero
+template <typename F>
+BenchResult run_benchmark(const std::string& name, const std::string& location, F function, double bytes = 0.0, double items = 0.0, bool print = true) {
+    typedef typename std::is_void<decltype(function())>::type returns_void;
+    auto time_batch = [&](unsigned long long iterations) {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long long i = 0; i < iterations; i++) {
+            bench_invoke(function, returns_void());
+        }
+        auto end = std::chrono::steady_clock::now();
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    };
+
+    // Warm up, growing the batch until a single batch takes a whole sample
+    unsigned long long iterations = 1;
+    double warmup = 0.0;
+    while (true) {
+        double elapsed = time_batch(iterations);
+        warmup += elapsed;
+        if (elapsed < BENCH_SAMPLE_NS && iterations < (1ULL << 40)) { // The cap only matters for bodies optimized down to nothing
+            // Grow towards the target, at most 10x at a time so one slow outlier can't overshoot it
+            double scale = elapsed > 0.0 ? BENCH_SAMPLE_NS / elapsed : 10.0;
+            iterations = (unsigned long long)(iterations * std::min(std::max(scale, 1.5), 10.0)) + 1;
+        } else if (warmup >= BENCH_WARMUP_NS) {
+            break;
+        }
+    }
+
+    // Measure
+    std::vector<double> samples;
+    double spent = 0.0;
+    while (samples.size() < BENCH_SAMPLES && (samples.size() < 10 || spent < BENCH_MAX_NS)) {
+        double elapsed = time_batch(iterations);
+        spent += elapsed;
+        samples.push_back(elapsed / iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult result;
+    result.name = name;
+    result.location = location;
+    result.iterations = iterations;
+    result.samples = samples.size();
+    result.min_ns = samples.front();
+    result.median_ns = samples[samples.size() / 2];
+    result.p99_ns = samples[(size_t)std::ceil(samples.size() * 0.99) - 1];
+    result.mean_ns = spent / (samples.size() * iterations);
+    result.bytes_per_second = bytes > 0.0 ? bytes * 1e9 / result.median_ns : 0.0;
+    result.items_per_second = items > 0.0 ? items * 1e9 / result.median_ns : 0.0;
+    if (print) {
+        std::cout << result << std::endl;
+    }
+    return result;
+}
+
+// Benchmarking macros
+#define BENCH(n, x) run_benchmark(n, LOCATION, [&]() {return x;});
+#define BENCH_BYTES(n, b, x) run_benchmark(n, LOCATION, [&]() {return x;}, b);
+#define BENCH_ITEMS(n, i, x) run_benchmark(n, LOCATION, [&]() {return x;}, 0.0, i);
+
+// Profiling macros
+
+// A profiled call site, declared once per PROFILE_SCOPE(n) as a static, so its address identifies the site
+struct ProfileSite {
+    const char* name;
+    SourceLocation location;
+};
+
+// One node of a per-thread profile tree: a call site, as reached through one particular chain of enclosing scopes
+struct ProfileNode {
+    const ProfileSite* site = nullptr; // Null for the root of a thread's tree
+    ProfileNode* parent = nullptr;
+    std::vector<std::unique_ptr<ProfileNode>> children;
+    ProfileNode* last_child = nullptr; // The most recently entered child, checked first as loops tend to re-enter the same scope
+    unsigned long long count = 0;
+    unsigned long long total_ns = 0; // Inclusive of children
+    unsigned long long min_ns = ~0ULL;
+    unsigned long long max_ns = 0;
+
+    // Returns the child node for a site, creating it on first entry
+    ProfileNode* child(const ProfileSite* child_site) {
+        if (last_child != nullptr && last_child->site == child_site) {
+            return last_child;
+        }
+        for (const std::unique_ptr<ProfileNode>& c : children) {
+            if (c->site == child_site) {
+                last_child = c.get();
+                return last_child;
+            }
+        }
+        children.emplace_back(new ProfileNode());
+        last_child = children.back().get();
+        last_child->site = child_site;
+        last_child->parent = this;
+        return last_child;
+    }
+};
+
+// The profile tree of one thread, and the scope that thread is currently in
+struct ProfileThread {
+    ProfileNode root;
+    ProfileNode* current = &root;
+    unsigned int id = 0; // Order in which threads first entered a profiled scope
+};
+
+std::mutex PROFILE_MUTEX; // Guards the list of per-thread trees, taken once per thread and when reporting
+
+// Returns the profile trees of every thread that has ever entered a profiled scope
+std::vector<std::unique_ptr<ProfileThread>>& profile_registry() {
+    static std::vector<std::unique_ptr<ProfileThread>> registry;
+    return registry;
+}
+
+// Returns the profile tree of the calling thread, registering it on first use
+ProfileThread& profile_local_thread() {
+    thread_local ProfileThread* local = nullptr;
+    if (local == nullptr) {
+        std::lock_guard<std::mutex> lock(PROFILE_MUTEX);
+        profile_registry().emplace_back(new ProfileThread());
+        local = profile_registry().back().get();
+        local->id = profile_registry().size() - 1;
+    }
+    return *local;
+}
+
+// Times the enclosing scope into the calling thread's profile tree, see PROFILE_SCOPE(n)
+class ProfileScope {
+public:
+    explicit ProfileScope(const ProfileSite& site) {
+        thread = &profile_local_thread();
+        node = thread->current->child(&site);
+        thread->current = node;
+        start = std::chrono::steady_clock::now();
+    }
+    ~ProfileScope() {
+        unsigned long long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        node->count++;
+        node->total_ns += elapsed;
+        node->min_ns = std::min(node->min_ns, elapsed);
+        node->max_ns = std::max(node->max_ns, elapsed);
+        thread->current = node->parent;
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+private:
+    ProfileThread* thread;
+    ProfileNode* node;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Prints a profile node and its children, children sorted by inclusive time
+void profile_report_node(std::ostream& out, const ProfileNode& node, int depth) {
+    std::vector<const ProfileNode*> children;
+    unsigned long long children_ns = 0;
+    for (const std::unique_ptr<ProfileNode>& c : node.children) {
+        children.push_back(c.get());
+        children_ns += c->total_ns;
+    }
+    std::sort(children.begin(), children.end(), [](const ProfileNode* a, const ProfileNode* b) {return a->total_ns > b->total_ns;});
+
+    if (node.site != nullptr) {
+        out << std::string(depth * 4, ' ') << T_CYAN << node.site->name << " @ " << node.site->location << ": " << T_GREEN << bench_format_ns(node.total_ns)
+            << T_RESET << " total (" << bench_format_ns(node.total_ns - std::min(children_ns, node.total_ns)) << " self), "
+            << node.count << " calls, mean " << bench_format_ns(node.total_ns / (double)node.count)
+            << ", min " << bench_format_ns(node.min_ns) << ", max " << bench_format_ns(node.max_ns) << "\n";
+    }
+    for (const ProfileNode* c : children) {
+        profile_report_node(out, *c, node.site != nullptr ? depth + 1 : depth);
+    }
+}
+
+// Prints the profile tree of every thread, each level sorted by inclusive time
+// Only call this while no other thread is inside a profiled scope, such as after joining them
+void profile_report(std::ostream& out = std::cout) {
+    std::lock_guard<std::mutex> lock(PROFILE_MUTEX);
+    out << T_CYAN << "+----------------+\n| PROFILE REPORT |\n+----------------+" << T_RESET << "\n";
+    for (const std::unique_ptr<ProfileThread>& thread : profile_registry()) {
+        out << T_CYAN << "Thread " << thread->id << ":" << T_RESET << "\n";
+        profile_report_node(out, thread->root, 1);
+    }
+    out << std::flush;
+}
+
+#define PROFILE_SCOPE(n) static const ProfileSite ALEXANDRIA_CONCAT(alexandria_profile_site_, __LINE__) = {n, SOURCE_LOCATION}; ProfileScope ALEXANDRIA_CONCAT(alexandria_profile_scope_, __LINE__)(ALEXANDRIA_CONCAT(alexandria_profile_site_, __LINE__));
+#define PROFILE_REPORT() profile_report();
+
+// Tracing settings, each of which may be defined before including this file to override it
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 65536 // Number of events kept per thread, after which the oldest are overwritten
+#endif
+#ifndef TRACE_NAME_LENGTH
+#define TRACE_NAME_LENGTH 64 // Maximum length of a traced section's name, including the terminator. Longer names are truncated
+#endif
+
+// A completed timed section, recorded as one Chrome trace-event "complete" (ph "X") event
+struct TraceEvent {
+    char name[TRACE_NAME_LENGTH]; // Copied, so that names built at runtime may be traced
+    unsigned long long begin_ns; // Since trace_start()
+    unsigned long long duration_ns;
+};
+
+// The ring of trace events recorded by one thread
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    std::atomic<unsigned long long> recorded{0}; // Total events ever recorded, the next is written at recorded % TRACE_BUFFER_EVENTS
+    unsigned int id = 0; // Order in which threads first recorded an event, used as the trace's thread id
+};
+
+std::atomic<bool> TRACE_ACTIVE(false); // Whether timed sections are currently being recorded, see trace_start()
+std::chrono::steady_clock::time_point TRACE_EPOCH; // When tracing started, event times are relative to this
+std::mutex TRACE_MUTEX; // Guards the list of per-thread buffers, taken once per thread and when starting/saving
+
+// Returns the trace buffers of every thread that has ever recorded an event
+std::vector<std::unique_ptr<TraceBuffer>>& trace_registry() {
+    static std::vector<std::unique_ptr<TraceBuffer>> registry;
+    return registry;
+}
+
+// Returns the trace buffer of the calling thread, registering it on first use
+TraceBuffer& trace_local_buffer() {
+    thread_local TraceBuffer* local = nullptr;
+    if (local == nullptr) {
+        std::lock_guard<std::mutex> lock(TRACE_MUTEX);
+        trace_registry().emplace_back(new TraceBuffer());
+        local = trace_registry().back().get();
+        local->events.resize(TRACE_BUFFER_EVENTS);
+        local->id = trace_registry().size() - 1;
+    }
+    return *local;
+}
+
+// Clears any previously recorded events and starts recording timed sections
+// Only call this while no other thread is inside a traced section
+void trace_start() {
+    std::lock_guard<std::mutex> lock(TRACE_MUTEX);
+    for (const std::unique_ptr<TraceBuffer>& buffer : trace_registry()) {
+        buffer->recorded.store(0, std::memory_order_relaxed);
+    }
+    TRACE_EPOCH = std::chrono::steady_clock::now();
+    TRACE_ACTIVE.store(true, std::memory_order_release);
+}
+
+// Stops recording timed sections, keeping what was recorded for trace_save(path)
+void trace_stop() {
+    TRACE_ACTIVE.store(false, std::memory_order_release);
+}
+
+// Records a timed section that ran from begin to end, if tracing is active. Never allocates or locks after a thread's first event
+void trace_record(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+    if (!TRACE_ACTIVE.load(std::memory_order_acquire) || begin < TRACE_EPOCH) {
+        return;
+    }
+    TraceBuffer& buffer = trace_local_buffer();
+    unsigned long long index = buffer.recorded.load(std::memory_order_relaxed);
+    TraceEvent& event = buffer.events[index % TRACE_BUFFER_EVENTS];
+    strncpy(event.name, name, TRACE_NAME_LENGTH - 1);
+    event.name[TRACE_NAME_LENGTH - 1] = '\0';
+    event.begin_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - TRACE_EPOCH).count();
+    event.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    buffer.recorded.store(index + 1, std::memory_order_release);
+}
+void trace_record(const std::string& name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+    trace_record(name.c_str(), begin, end);
+}
+
+// Writes a string as a JSON string literal
+void trace_write_json_string(std::ostream& out, const char* text) {
+    out << '"';
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\' << *c;
+        } else if ((unsigned char)*c < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)*c << std::dec << std::setfill(' ');
+        } else {
+            out << *c;
+        }
+    }
+    out << '"';
+}
+
+// Writes every recorded event as Chrome trace-event JSON, which loads in Perfetto (ui.perfetto.dev) or chrome://tracing
+// Returns false if the file couldn't be written. Only call this after trace_stop(), once traced threads are done
+bool trace_save(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(TRACE_MUTEX);
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+    out << std::fixed << std::setprecision(3);
+    bool first = true;
+    for (const std::unique_ptr<TraceBuffer>& buffer : trace_registry()) {
+        out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << buffer->id
+            << ", \"args\": {\"name\": \"Thread " << buffer->id << "\"}}";
+        first = false;
+
+        // Once the ring has wrapped, only the newest TRACE_BUFFER_EVENTS events remain
+        unsigned long long recorded = buffer->recorded.load(std::memory_order_acquire);
+        unsigned long long oldest = recorded > TRACE_BUFFER_EVENTS ? recorded - TRACE_BUFFER_EVENTS : 0;
+        for (unsigned long long i = oldest; i < recorded; i++) {
+            const TraceEvent& event = buffer->events[i % TRACE_BUFFER_EVENTS];
+            out << ",\n{\"name\": ";
+            trace_write_json_string(out, event.name);
+            out << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " << buffer->id << ", \"ts\": " << event.begin_ns / 1000.0 << ", \"dur\": " << event.duration_ns / 1000.0 << "}";
+        }
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
+
+// Records the enclosing scope as a trace event when tracing is active, see TRACE_SCOPE(n)
+class TraceScope {
+public:
+    explicit TraceScope(const char* section_name) : name(section_name), start(std::chrono::steady_clock::now()) {}
+    ~TraceScope() {
+        trace_record(name, start, std::chrono::steady_clock::now());
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+private:
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define TRACE_SCOPE(n) TraceScope ALEXANDRIA_CONCAT(alexandria_trace_scope_, __LINE__)(n);
+#define TRACE_START() trace_start();
+#define TRACE_STOP() trace_stop();
+#define TRACE_SAVE(path) trace_save(path);
+
+#ifdef ALEXANDRIA_TSC_AVAILABLE
+// Cycle-accurate timing, used by the TIME macros when USE_ALEXANDRIA_TSC is defined
+
+// Whether the timestamp counter ticks at a constant rate regardless of frequency scaling and sleep states, so that cycles can be turned into time
+bool tsc_is_invariant() {
+    unsigned int regs[4] = {0, 0, 0, 0};
+#ifdef _MSC_VER
+    __cpuid((int*)regs, 0x80000000);
+    if (regs[0] < 0x80000007) {
+        return false;
+    }
+    __cpuid((int*)regs, 0x80000007);
+#else
+    if (!__get_cpuid(0x80000007, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        return false;
+    }
+#endif
+    return (regs[3] >> 8) & 1;
+}
+
+// Reads the timestamp counter at the start of a timed section. The fences keep earlier instructions from leaking into the section
+inline unsigned long long tsc_begin() {
+    _mm_lfence();
+    unsigned long long cycles = __rdtsc();
+    _mm_lfence();
+    return cycles;
+}
+
+// Reads the timestamp counter at the end of a timed section. rdtscp waits for the section to finish, and the fence keeps later instructions out of it
+inline unsigned long long tsc_end() {
+    unsigned int processor;
+    unsigned long long cycles = __rdtscp(&processor);
+    _mm_lfence();
+    return cycles;
+}
+
+// Measures the nanoseconds per timestamp counter tick against steady_clock, spinning for about 10ms
+double tsc_calibrate() {
+    auto start = std::chrono::steady_clock::now();
+    unsigned long long start_cycles = tsc_begin();
+    auto end = start;
+    while (end - start < std::chrono::milliseconds(10)) {
+        end = std::chrono::steady_clock::now();
+    }
+    unsigned long long end_cycles = tsc_end();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / (double)(end_cycles - start_cycles);
+}
+
+// Measures the cycles taken by an empty tsc_begin()/tsc_end() pair, which is subtracted from every timed section
+unsigned long long tsc_measure_overhead() {
+    unsigned long long overhead = ~0ULL;
+    for (int i = 0; i < 1000; i++) {
+        unsigned long long start_cycles = tsc_begin();
+        unsigned long long end_cycles = tsc_end();
+        overhead = std::min(overhead, end_cycles - start_cycles);
+    }
+    return overhead;
+}
+
+const bool TSC_INVARIANT = tsc_is_invariant(); // If false, cycles are still printed but the nanoseconds are only approximate
+const double TSC_NS_PER_CYCLE = tsc_calibrate(); // Calibrated once at startup
+const unsigned long long TSC_OVERHEAD_CYCLES = tsc_measure_overhead();
+
+// Formats the cycles of a timed section (less the measurement overhead) as nanoseconds and cycles, such as "41.3ns (124 cycles)"
+std::string tsc_format_cycles(unsigned long long cycles) {
+    cycles = cycles > TSC_OVERHEAD_CYCLES ? cycles - TSC_OVERHEAD_CYCLES : 0;
+    return (TSC_INVARIANT ? "" : "~") + bench_format_ns(cycles * TSC_NS_PER_CYCLE) + " (" + std::to_string(cycles) + " cycles)";
+}
+#endif
+
+#ifdef ALEXANDRIA_PERF_AVAILABLE
+// Hardware counters, used by the TIME macros when USE_ALEXANDRIA_PERF_COUNTERS is defined
+
+// The counters opened for each thread. Hardware events are preferred, and the software ones are used when perf_event_paranoid (or a VM) forbids them
+enum PerfCounterIndex {
+    PERF_INDEX_CYCLES,
+    PERF_INDEX_INSTRUCTIONS,
+    PERF_INDEX_L1D_LOADS,
+    PERF_INDEX_L1D_LOAD_MISSES,
+    PERF_INDEX_LLC_REFERENCES,
+    PERF_INDEX_LLC_MISSES,
+    PERF_INDEX_BRANCHES,
+    PERF_INDEX_BRANCH_MISSES,
+    PERF_INDEX_TASK_CLOCK,
+    PERF_INDEX_PAGE_FAULTS,
+    PERF_INDEX_CONTEXT_SWITCHES,
+    PERF_INDEX_MIGRATIONS,
+    PERF_INDEX_COUNT
+};
+
+// Opens one counter for the calling thread, in user space only (which is all perf_event_paranoid = 2 allows). Returns -1 if it can't be opened
+int perf_open(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING; // To scale counts when the PMU is shared between too many events
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// The counters of one thread, opened on the thread's first timed section and closed when it exits
+struct PerfCounters {
+    int fds[PERF_INDEX_COUNT];
+    bool hardware; // Whether the hardware counters could be opened, otherwise only the software ones are
+
+    PerfCounters() {
+        const uint64_t l1d_loads = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16);
+        const uint64_t l1d_load_misses = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        fds[PERF_INDEX_CYCLES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        hardware = fds[PERF_INDEX_CYCLES] >= 0;
+        fds[PERF_INDEX_INSTRUCTIONS] = hardware ? perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS) : -1;
+        fds[PERF_INDEX_L1D_LOADS] = hardware ? perf_open(PERF_TYPE_HW_CACHE, l1d_loads) : -1;
+        fds[PERF_INDEX_L1D_LOAD_MISSES] = hardware ? perf_open(PERF_TYPE_HW_CACHE, l1d_load_misses) : -1;
+        fds[PERF_INDEX_LLC_REFERENCES] = hardware ? perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES) : -1;
+        fds[PERF_INDEX_LLC_MISSES] = hardware ? perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES) : -1;
+        fds[PERF_INDEX_BRANCHES] = hardware ? perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS) : -1;
+        fds[PERF_INDEX_BRANCH_MISSES] = hardware ? perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES) : -1;
+        fds[PERF_INDEX_TASK_CLOCK] = perf_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+        fds[PERF_INDEX_PAGE_FAULTS] = perf_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+        fds[PERF_INDEX_CONTEXT_SWITCHES] = perf_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+        fds[PERF_INDEX_MIGRATIONS] = perf_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS);
+    }
+    ~PerfCounters() {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+};
+
+// Returns the counters of the calling thread, opening them on first use
+PerfCounters& perf_local_counters() {
+    thread_local PerfCounters counters;
+    return counters;
+}
+
+// The raw readings of every counter of a thread at one point in time: value, time enabled, and time running
+struct PerfSnapshot {
+    uint64_t readings[PERF_INDEX_COUNT][3];
+};
+
+// Reads every open counter of the calling thread. Unopened counters read as zero
+PerfSnapshot perf_snapshot() {
+    PerfCounters& counters = perf_local_counters();
+    PerfSnapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    for (int i = 0; i < PERF_INDEX_COUNT; i++) {
+        if (counters.fds[i] >= 0 && read(counters.fds[i], snapshot.readings[i], sizeof(snapshot.readings[i])) != sizeof(snapshot.readings[i])) {
+            memset(snapshot.readings[i], 0, sizeof(snapshot.readings[i]));
+        }
+    }
+    return snapshot;
+}
+
+// The change in every counter between two snapshots of the same thread
+struct PerfResult {
+    bool hardware; // Whether the hardware counters were available, see PerfCounters
+    bool available[PERF_INDEX_COUNT]; // Whether each counter could be opened
+    double counts[PERF_INDEX_COUNT]; // Scaled up by enabled / running time if the counter was multiplexed
+};
+
+// Returns the change in every counter from start to end
+PerfResult perf_difference(const PerfSnapshot& start, const PerfSnapshot& end) {
+    PerfCounters& counters = perf_local_counters();
+    PerfResult result;
+    result.hardware = counters.hardware;
+    for (int i = 0; i < PERF_INDEX_COUNT; i++) {
+        result.available[i] = counters.fds[i] >= 0;
+        double value = (double)(end.readings[i][0] - start.readings[i][0]);
+        double enabled = (double)(end.readings[i][1] - start.readings[i][1]);
+        double running = (double)(end.readings[i][2] - start.readings[i][2]);
+        result.counts[i] = running > 0.0 ? value * (enabled / running) : value;
+    }
+    return result;
+}
+
+// Formats a ratio of two counters as a percentage, or "n/a" if either counter is unavailable or the denominator is zero
+std::string perf_format_percent(const PerfResult& result, int numerator, int denominator) {
+    if (!result.available[numerator] || !result.available[denominator] || result.counts[denominator] <= 0.0) {
+        return "n/a";
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2) << 100.0 * result.counts[numerator] / result.counts[denominator] << "%";
+    return out.str();
+}
+
+// PerfResult streaming/printing, as IPC and miss rates if hardware counters were available, otherwise as the software counters
+std::ostream& operator << (std::ostream& out, const PerfResult& rhs) {
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    if (rhs.hardware) {
+        out << "IPC ";
+        if (rhs.available[PERF_INDEX_INSTRUCTIONS] && rhs.counts[PERF_INDEX_CYCLES] > 0.0) {
+            out << std::fixed << std::setprecision(2) << rhs.counts[PERF_INDEX_INSTRUCTIONS] / rhs.counts[PERF_INDEX_CYCLES];
+        } else {
+            out << "n/a";
+        }
+        out << std::fixed << std::setprecision(0) << " (" << rhs.counts[PERF_INDEX_INSTRUCTIONS] << " instructions, " << rhs.counts[PERF_INDEX_CYCLES] << " cycles)"
+            << ", L1d miss " << perf_format_percent(rhs, PERF_INDEX_L1D_LOAD_MISSES, PERF_INDEX_L1D_LOADS)
+            << ", LLC miss " << perf_format_percent(rhs, PERF_INDEX_LLC_MISSES, PERF_INDEX_LLC_REFERENCES)
+            << ", branch miss " << perf_format_percent(rhs, PERF_INDEX_BRANCH_MISSES, PERF_INDEX_BRANCHES);
+    } else {
+        out << "no hardware counters, task-clock " << bench_format_ns(rhs.counts[PERF_INDEX_TASK_CLOCK]) << std::fixed << std::setprecision(0)
+            << ", " << rhs.counts[PERF_INDEX_PAGE_FAULTS] << " page faults"
+            << ", " << rhs.counts[PERF_INDEX_CONTEXT_SWITCHES] << " context switches"
+            << ", " << rhs.counts[PERF_INDEX_MIGRATIONS] << " migrations";
+    }
+    out.flags(flags);
+    out.precision(precision);
+    return out;
+}
+#endif
+
+#ifdef USE_ALEXANDRIA_FLIGHT_RECORDER
+// Flight recorder, a crash-safe memory of the most recent events of every thread, used when USE_ALEXANDRIA_FLIGHT_RECORDER is defined
+// Recording copies a few words into a per-thread ring, and never formats, allocates, or locks after a thread's first event
+
+// Flight recorder settings, each of which may be defined before including this file to override it
+#ifndef FLIGHT_RECORDER_EVENTS
+#define FLIGHT_RECORDER_EVENTS 256 // Number of most recent events kept per thread
+#endif
+#ifndef FLIGHT_RECORDER_THREADS
+#define FLIGHT_RECORDER_THREADS 256 // Maximum number of threads recorded, later threads record nothing
+#endif
+#ifndef FLIGHT_RECORDER_PATH
+#define FLIGHT_RECORDER_PATH "alexandria_flight.txt" // File dumped to on a crash, unless flight_recorder_install(path) is called with another
+#endif
+#ifndef FLIGHT_RECORDER_SIGNAL_STACK_SIZE
+#define FLIGHT_RECORDER_SIGNAL_STACK_SIZE 65536 // Bytes of each thread's alternate stack for the crash handler, so a stack overflow can still be dumped
+#endif
+
+// Kinds of flight recorder events, other than the LOG_LEVEL_<...> of logging macros
+#define FLIGHT_EVENT_TIME 5 // A TIME or TIME_NAMED section, with its name and elapsed nanoseconds
+#define FLIGHT_EVENT_CUSTOM 6 // A FLIGHT_RECORD(text, value)
+
+// One recorded event. Only pointers to string literals are kept, except for the copied note
+struct FlightEvent {
+    const char* file;
+    const char* function;
+    const char* text; // The source text of a logged message, or of a FLIGHT_RECORD(text, value)
+    unsigned int line;
+    int kind; // A LOG_LEVEL_<...> or FLIGHT_EVENT_<...>
+    unsigned long long time_ns; // Since the program started
+    long long value;
+    char note[24]; // Copied, such as the name of a TIME_NAMED section
+};
+
+// The ring of events recorded by one thread
+struct FlightRing {
+    FlightEvent events[FLIGHT_RECORDER_EVENTS];
+    std::atomic<unsigned long long> recorded{0}; // Total events ever recorded, the next is written at recorded % FLIGHT_RECORDER_EVENTS
+};
+
+// Fixed-size so that the crash handler can walk it without locking
+std::atomic<FlightRing*> FLIGHT_RINGS[FLIGHT_RECORDER_THREADS];
+std::atomic<unsigned int> FLIGHT_RING_COUNT(0);
+const std::chrono::steady_clock::time_point FLIGHT_EPOCH = std::chrono::steady_clock::now();
+
+// Returns the nanoseconds since the program started, from the timestamp counter if USE_ALEXANDRIA_TSC is defined
+inline unsigned long long flight_now_ns() {
+#ifdef ALEXANDRIA_TSC_AVAILABLE
+    static const unsigned long long start_cycles = __rdtsc();
+    return (unsigned long long)((__rdtsc() - start_cycles) * TSC_NS_PER_CYCLE);
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - FLIGHT_EPOCH).count();
+#endif
+}
+
+// Returns the calling thread's ring, registering it on first use, or nullptr if FLIGHT_RECORDER_THREADS threads already have
+inline FlightRing* flight_local_ring() {
+    thread_local FlightRing* ring = nullptr;
+    thread_local bool registered = false;
+    if (!registered) {
+        registered = true;
+        unsigned int index = FLIGHT_RING_COUNT.fetch_add(1);
+        if (index < FLIGHT_RECORDER_THREADS) {
+            ring = new FlightRing(); // Never freed, so that events of exited threads can still be dumped
+            FLIGHT_RINGS[index].store(ring, std::memory_order_release);
+        }
+    }
+    return ring;
+}
+
+// Records an event in the calling thread's ring. text must be a string literal, and note is copied (truncated)
+inline void flight_record(int kind, const SourceLocation& location, const char* text, long long value = 0, const char* note = nullptr) {
+    FlightRing* ring = flight_local_ring();
+    if (ring == nullptr) {
+        return;
+    }
+    unsigned long long index = ring->recorded.load(std::memory_order_relaxed);
+    FlightEvent& event = ring->events[index % FLIGHT_RECORDER_EVENTS];
+    event.file = location.file;
+    event.function = location.function;
+    event.text = text;
+    event.line = location.line;
+    event.kind = kind;
+    event.time_ns = flight_now_ns();
+    event.value = value;
+    if (note != nullptr) {
+        strncpy(event.note, note, sizeof(event.note) - 1);
+        event.note[sizeof(event.note) - 1] = '\0';
+    } else {
+        event.note[0] = '\0';
+    }
+    ring->recorded.store(index + 1, std::memory_order_release);
+}
+
+// Writes a string to a file descriptor, using only async-signal-safe calls
+void flight_write(int fd, const char* text) {
+    if (text != nullptr) {
+        size_t length = strlen(text);
+        while (length > 0) {
+            ssize_t written = write(fd, text, length);
+            if (written <= 0) {
+                return;
+            }
+            text += written;
+            length -= written;
+        }
+    }
+}
+
+// Writes an integer to a file descriptor, padded with zeroes to at least width digits, using only async-signal-safe calls
+void flight_write_number(int fd, long long value, int width = 1) {
+    char digits[24];
+    int count = 0;
+    bool negative = value < 0;
+    unsigned long long magnitude = negative ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[sizeof(digits) - 1 - count++] = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0 || count < width);
+    if (negative) {
+        digits[sizeof(digits) - 1 - count++] = '-';
+    }
+    ssize_t ignored = write(fd, digits + sizeof(digits) - count, count);
+    (void)ignored;
+}
+
+// Writes every thread's recorded events to a file descriptor, oldest first, using only async-signal-safe calls
+void flight_recorder_dump(int fd) {
+    const char* kinds[] = {"NONE", "ERROR", "WARNING", "PASS", "LOG", "TIME", "EVENT"};
+    flight_write(fd, "Flight recorder, times in seconds since start\n");
+    unsigned int rings = std::min(FLIGHT_RING_COUNT.load(std::memory_order_acquire), (unsigned int)FLIGHT_RECORDER_THREADS);
+    for (unsigned int t = 0; t < rings; t++) {
+        FlightRing* ring = FLIGHT_RINGS[t].load(std::memory_order_acquire);
+        if (ring == nullptr) {
+            continue;
+        }
+        flight_write(fd, "Thread ");
+        flight_write_number(fd, t);
+        flight_write(fd, ":\n");
+        unsigned long long recorded = ring->recorded.load(std::memory_order_acquire);
+        unsigned long long oldest = recorded > FLIGHT_RECORDER_EVENTS ? recorded - FLIGHT_RECORDER_EVENTS : 0;
+        for (unsigned long long i = oldest; i < recorded; i++) {
+            const FlightEvent& event = ring->events[i % FLIGHT_RECORDER_EVENTS];
+            flight_write(fd, "    [");
+            flight_write_number(fd, event.time_ns / 1000000000ULL);
+            flight_write(fd, ".");
+            flight_write_number(fd, event.time_ns % 1000000000ULL, 9);
+            flight_write(fd, "] ");
+            flight_write(fd, event.kind >= 0 && event.kind <= FLIGHT_EVENT_CUSTOM ? kinds[event.kind] : "?");
+            flight_write(fd, " @ ");
+            flight_write(fd, event.file);
+            flight_write(fd, ":");
+            flight_write_number(fd, event.line);
+            flight_write(fd, ":");
+            flight_write(fd, event.function);
+            if (event.kind == FLIGHT_EVENT_TIME) {
+                flight_write(fd, ": \"");
+                flight_write(fd, event.note);
+                flight_write(fd, "\" in ");
+                flight_write_number(fd, event.value);
+                flight_write(fd, "ns\n");
+            } else {
+                flight_write(fd, ": ");
+                flight_write(fd, event.text);
+                if (event.kind == FLIGHT_EVENT_CUSTOM) {
+                    flight_write(fd, " = ");
+                    flight_write_number(fd, event.value);
+                }
+                flight_write(fd, "\n");
+            }
+        }
+    }
+}
+
+#ifdef ALEXANDRIA_FLIGHT_RECORDER_SIGNALS
+char FLIGHT_RECORDER_DUMP_PATH[4096] = FLIGHT_RECORDER_PATH; // Copied in advance, as the crash handler can't build strings
+
+// Dumps the flight recorder on a crash, then lets the signal take its default course
+extern "C" void flight_recorder_signal_handler(int signal_number) {
+    int fd = open(FLIGHT_RECORDER_DUMP_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        flight_write(fd, "Caught signal ");
+        flight_write_number(fd, signal_number);
+        flight_write(fd, "\n");
+        flight_recorder_dump(fd);
+        close(fd);
+        flight_write(STDERR_FILENO, "Flight recorder dumped to ");
+        flight_write(STDERR_FILENO, FLIGHT_RECORDER_DUMP_PATH);
+        flight_write(STDERR_FILENO, "\n");
+    }
+    signal(signal_number, SIG_DFL); // Already reset by SA_RESETHAND, this is only for clarity
+    raise(signal_number);
+}
+
+// A thread's alternate stack for the crash handler, disabled again before it is freed as the thread exits
+struct FlightSignalStack {
+    FlightSignalStack() : memory(new char[FLIGHT_RECORDER_SIGNAL_STACK_SIZE]) {
+        stack_t stack;
+        memset(&stack, 0, sizeof(stack));
+        stack.ss_sp = memory.get();
+        stack.ss_size = FLIGHT_RECORDER_SIGNAL_STACK_SIZE;
+        installed = sigaltstack(&stack, nullptr) == 0;
+    }
+    ~FlightSignalStack() {
+        if (installed) {
+            stack_t stack;
+            memset(&stack, 0, sizeof(stack));
+            stack.ss_flags = SS_DISABLE;
+            sigaltstack(&stack, nullptr);
+        }
+    }
+    FlightSignalStack(const FlightSignalStack&) = delete;
+    FlightSignalStack& operator=(const FlightSignalStack&) = delete;
+
+    std::unique_ptr<char[]> memory;
+    bool installed;
+};
+
+// Gives the calling thread an alternate stack for the crash handler, unless it already has one. Returns false if it couldn't
+// Without one, a stack overflow runs the handler on the exhausted stack and nothing is dumped. flight_recorder_install(path) calls this for its own
+//  thread, and every other thread that should have its stack overflows dumped needs to call it once
+bool flight_recorder_signal_stack() {
+    stack_t current;
+    if (sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_DISABLE)) {
+        return true;
+    }
+    thread_local FlightSignalStack stack;
+    return stack.installed;
+}
+
+// Installs the crash handler for SIGSEGV, SIGABRT, SIGBUS, SIGFPE, and SIGILL, dumping to path. Done at startup with FLIGHT_RECORDER_PATH
+bool flight_recorder_install(const char* path = FLIGHT_RECORDER_PATH) {
+    strncpy(FLIGHT_RECORDER_DUMP_PATH, path, sizeof(FLIGHT_RECORDER_DUMP_PATH) - 1);
+    FLIGHT_RECORDER_DUMP_PATH[sizeof(FLIGHT_RECORDER_DUMP_PATH) - 1] = '\0';
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = flight_recorder_signal_handler;
+    action.sa_flags = SA_RESETHAND | SA_ONSTACK; // A second crash within the handler takes the default action
+    sigemptyset(&action.sa_mask);
+    bool installed = flight_recorder_signal_stack();
+    for (int signal_number : {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL}) {
+        installed = sigaction(signal_number, &action, nullptr) == 0 && installed;
+    }
+    return installed;
+}
+
+const bool FLIGHT_RECORDER_INSTALLED = flight_recorder_install();
+#endif
+
+#define FLIGHT_RECORD(text, value) flight_record(FLIGHT_EVENT_CUSTOM, SOURCE_LOCATION, text, value);
+#else
+#define FLIGHT_RECORD(text, value)
+#endif
+
+// A section timed by TIME(x) or TIME_NAMED(n, x), reading every enabled clock and counter around it
+// Counters are read outside the clocks, so that the cost of reading them isn't part of the printed time
+class TimedSection {
+public:
+    explicit TimedSection(const SourceLocation& section_location) : location(section_location), named(false) {
+        begin();
+    }
+    TimedSection(const std::string& section_name, const SourceLocation& section_location) : location(section_location), named(true), name(section_name) {
+        begin();
+    }
+
+    // Stops timing, records the section if tracing is active, and prints it
+    void end() {
+#ifdef ALEXANDRIA_TSC_AVAILABLE
+        unsigned long long end_cycles = tsc_end();
+#endif
+        auto end_time = std::chrono::steady_clock::now();
+#ifdef ALEXANDRIA_PERF_AVAILABLE
+        PerfSnapshot perf_end = perf_snapshot();
+#endif
+        if (TRACE_ACTIVE) {
+            trace_record(named ? name : to_string(location), start_time, end_time);
+        }
+#ifdef USE_ALEXANDRIA_FLIGHT_RECORDER
+        flight_record(FLIGHT_EVENT_TIME, location, "", std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count(), named ? name.c_str() : "");
+#endif
+        std::cout << T_CYAN << "Ended timed section ";
+        if (named) {
+            std::cout << "\"" << name << "\" ";
+        }
+        std::cout << "@ " << location << " in " << T_GREEN;
+#ifdef ALEXANDRIA_TSC_AVAILABLE
+        std::cout << tsc_format_cycles(end_cycles - start_cycles);
+#else
+        std::cout << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << "ms";
+#endif
+#ifdef ALEXANDRIA_PERF_AVAILABLE
+        std::cout << T_CYAN << " | " << perf_difference(perf_start, perf_end);
+#endif
+        std::cout << T_RESET << std::endl;
+    }
+
+private:
+    void begin() {
+#ifdef ALEXANDRIA_PERF_AVAILABLE
+        perf_start = perf_snapshot();
+#endif
+        start_time = std::chrono::steady_clock::now();
+#ifdef ALEXANDRIA_TSC_AVAILABLE
+        start_cycles = tsc_begin();
+#endif
+    }
+
+    SourceLocation location;
+    bool named;
+    std::string name;
+    std::chrono::steady_clock::time_point start_time;
+#ifdef ALEXANDRIA_TSC_AVAILABLE
+    unsigned long long start_cycles;
+#endif
+#ifdef ALEXANDRIA_PERF_AVAILABLE
+    PerfSnapshot perf_start;
+#endif
+};
+
+// Latency histogram settings, which may be defined before including this file to override them
+#ifndef HISTOGRAM_SUB_BUCKET_BITS
+#define HISTOGRAM_SUB_BUCKET_BITS 5 // Each power of two is split into 2^this linear buckets, so values are kept to within 1/2^this (about 3%)
+#endif
+#define HISTOGRAM_SUB_BUCKETS (1ULL << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((65 - HISTOGRAM_SUB_BUCKET_BITS) * HISTOGRAM_SUB_BUCKETS) // Enough to cover every 64-bit value
+
+// Returns the index of the most significant set bit of a non-zero value
+inline int histogram_highest_bit(unsigned long long value) {
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+// Returns the log-linear bucket of a value: exact below HISTOGRAM_SUB_BUCKETS, then HISTOGRAM_SUB_BUCKETS linear buckets per power of two
+inline size_t histogram_bucket(unsigned long long value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (size_t)value;
+    }
+    int shift = histogram_highest_bit(value) - HISTOGRAM_SUB_BUCKET_BITS;
+    return (size_t)((shift + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> shift) - HISTOGRAM_SUB_BUCKETS));
+}
+
+// Returns the lowest value that falls in a bucket
+inline unsigned long long histogram_bucket_lowest(size_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned long long shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return (HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+// Returns the highest value that falls in a bucket
+inline unsigned long long histogram_bucket_highest(size_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned long long shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return histogram_bucket_lowest(bucket) + ((1ULL << shift) - 1);
+}
+
+// A point-in-time copy of a LatencyHistogram, which can be merged with others and queried
+struct LatencyHistogramSnapshot {
+    std::vector<unsigned long long> buckets = std::vector<unsigned long long>(HISTOGRAM_BUCKETS, 0);
+    unsigned long long count = 0;
+    unsigned long long sum = 0;
+    unsigned long long min = ~0ULL; // Exact, unlike the buckets
+    unsigned long long max = 0; // Exact, unlike the buckets
+
+    // Adds the values of another snapshot to this one
+    void merge(const LatencyHistogramSnapshot& other) {
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+
+    // Returns the value below which the given percent (in range [0, 100]) of recorded values fall, as the highest value of its bucket
+    // Never exceeds max, and is 0 if nothing was recorded
+    unsigned long long percentile(double percent) const {
+        if (count == 0) {
+            return 0;
+        }
+        unsigned long long rank = (unsigned long long)std::ceil(std::min(std::max(percent, 0.0), 100.0) / 100.0 * count);
+        rank = std::max(rank, 1ULL);
+        unsigned long long seen = 0;
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::min(std::max(histogram_bucket_highest(i), min), max);
+            }
+        }
+        return max;
+    }
+
+    // Returns the mean of the recorded values, or 0 if nothing was recorded
+    double mean() const {
+        return count == 0 ? 0.0 : sum / (double)count;
+    }
+};
+
+// LatencyHistogramSnapshot streaming/printing, treating values as nanoseconds
+std::ostream& operator << (std::ostream& out, const LatencyHistogramSnapshot& rhs) {
+    out << rhs.count << " values";
+    if (rhs.count > 0) {
+        out << ", min " << bench_format_ns(rhs.min) << ", p50 " << bench_format_ns(rhs.percentile(50.0)) << ", p90 " << bench_format_ns(rhs.percentile(90.0))
+            << ", p99 " << bench_format_ns(rhs.percentile(99.0)) << ", p99.9 " << bench_format_ns(rhs.percentile(99.9)) << ", max " << bench_format_ns(rhs.max)
+            << ", mean " << bench_format_ns(rhs.mean());
+    }
+    return out;
+}
+
+// A log-linear histogram of values (such as nanosecond latencies), which any number of threads can record into at once without locking
+// Recording is a handful of relaxed atomic operations, and snapshot() copies it out for merging and percentile queries
+class LatencyHistogram {
+public:
+    // Constant, so that a static histogram (such as for METRIC_RECORD) is initialized before anything runs
+    constexpr LatencyHistogram() : buckets{}, count{0}, sum{0}, min{~0ULL}, max{0} {}
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // Records one value
+    void record(unsigned long long value) {
+        buckets[histogram_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        unsigned long long current = min.load(std::memory_order_relaxed);
+        while (value < current && !min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+        current = max.load(std::memory_order_relaxed);
+        while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    // Copies out the recorded values. Values recorded during the copy may be partially included
+    LatencyHistogramSnapshot snapshot() const {
+        LatencyHistogramSnapshot result;
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            result.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        }
+        result.count = count.load(std::memory_order_relaxed);
+        result.sum = sum.load(std::memory_order_relaxed);
+        result.min = min.load(std::memory_order_relaxed);
+        result.max = max.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    // Clears every recorded value. Values recorded during the reset may be partially kept
+    void reset() {
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        min.store(~0ULL, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<unsigned long long> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<unsigned long long> count;
+    std::atomic<unsigned long long> sum;
+    std::atomic<unsigned long long> min;
+    std::atomic<unsigned long long> max;
+};
+
+// Times a section for TIME_HISTOGRAM(h, x), using the timestamp counter if USE_ALEXANDRIA_TSC is defined
+class HistogramSection {
+public:
+    explicit HistogramSection(LatencyHistogram& section_histogram) : histogram(section_histogram) {
+#ifdef ALEXANDRIA_TSC_AVAILABLE
+        start_cycles = tsc_begin();
+#else
+        start_time = std::chrono::steady_clock::now();
+#endif
+    }
+
+    // Stops timing and records the elapsed nanoseconds
+    void end() {
+#ifdef ALEXANDRIA_TSC_AVAILABLE
+        unsigned long long cycles = tsc_end() - start_cycles;
+        cycles = cycles > TSC_OVERHEAD_CYCLES ? cycles - TSC_OVERHEAD_CYCLES : 0;
+        histogram.record((unsigned long long)(cycles * TSC_NS_PER_CYCLE));
+#else
+        histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count());
+#endif
+    }
+
+private:
+    LatencyHistogram& histogram;
+#ifdef ALEXANDRIA_TSC_AVAILABLE
+    unsigned long long start_cycles;
+#else
+    std::chrono::steady_clock::time_point start_time;
+#endif
+};
+
+#define TIME_HISTOGRAM(h, x) {HistogramSection alexandria_histogram_section(h); x; alexandria_histogram_section.end();}
+
+// Kinds of metric, as named in the Prometheus text format
+enum MetricType {
+    METRIC_TYPE_COUNTER,
+    METRIC_TYPE_GAUGE,
+    METRIC_TYPE_SUMMARY // A MetricHistogram, exported as quantiles
+};
+
+template <typename Site> struct MetricEnrollment;
+
+// A named value registered once, by name and location, for export with metrics_write(out)
+// Metrics are meant to be globals or statics, so that updating one never looks it up. Names should match [a-zA-Z_:][a-zA-Z0-9_:]*
+class Metric {
+public:
+    constexpr Metric(const char* metric_name, const char* metric_help, const SourceLocation& metric_location, MetricType metric_type)
+        : name(metric_name), help(metric_help), location(metric_location), type(metric_type) {}
+    Metric(const Metric&) = delete;
+    Metric& operator=(const Metric&) = delete;
+
+    const char* name;
+    const char* help;
+    SourceLocation location;
+    MetricType type;
+
+protected:
+    // Adds this metric to (or removes it from) the exported list, called by the derived classes once their values exist
+    void enroll();
+    void withdraw();
+
+    template <typename Site> friend struct MetricEnrollment;
+};
+
+std::mutex METRICS_MUTEX; // Guards the list of metrics
+
+// Returns every metric that has been constructed
+std::vector<const Metric*>& metrics_registry() {
+    static std::vector<const Metric*> registry;
+    return registry;
+}
+
+void Metric::enroll() {
+    std::lock_guard<std::mutex> lock(METRICS_MUTEX);
+    metrics_registry().push_back(this);
+}
+
+void Metric::withdraw() {
+    std::lock_guard<std::mutex> lock(METRICS_MUTEX);
+    std::vector<const Metric*>& registry = metrics_registry();
+    registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+}
+
+// Writes the labels of a metric's sample, escaping the location as the text format requires
+void metric_write_labels(std::ostream& out, const Metric& metric, const char* quantile = nullptr) {
+    out << "{location=\"";
+    for (const char* c = metric.location.file; *c; c++) {
+        if (*c == '\\' || *c == '"') {
+            out << '\\';
+        }
+        if (*c == '\n') {
+            out << "\\n";
+        } else {
+            out << *c;
+        }
+    }
+    out << ":" << metric.location.line;
+    if (*metric.location.function) {
+        out << ":" << metric.location.function;
+    }
+    out << "\"";
+    if (quantile != nullptr) {
+        out << ",quantile=\"" << quantile << "\"";
+    }
+    out << "}";
+}
+
+// A count that only goes up, such as a number of requests handled. Adding to it is a single relaxed atomic add
+// A site is constant-initialized and never registers itself, for the static of METRIC_ADD(n, x); a MetricCounter registers for its lifetime
+class MetricCounterSite : public Metric {
+public:
+    constexpr MetricCounterSite(const char* metric_name, const char* metric_help, const SourceLocation& metric_location) : Metric(metric_name, metric_help, metric_location, METRIC_TYPE_COUNTER) {}
+
+    void add(unsigned long long amount = 1) {
+        count.fetch_add(amount, std::memory_order_relaxed);
+    }
+    unsigned long long value() const {
+        return count.load(std::memory_order_relaxed);
+    }
+    // Writes this metric's sample in the Prometheus text format, labelled with its location
+    void write(std::ostream& out) const {
+        out << name;
+        metric_write_labels(out, *this);
+        out << " " << value() << "\n";
+    }
+
+private:
+    std::atomic<unsigned long long> count{0};
+};
+
+class MetricCounter : public MetricCounterSite {
+public:
+    MetricCounter(const char* metric_name, const char* metric_help, const SourceLocation& metric_location) : MetricCounterSite(metric_name, metric_help, metric_location) {
+        enroll();
+    }
+    ~MetricCounter() {
+        withdraw();
+    }
+};
+
+// A value that can go up and down, such as a queue length. Setting it is a single relaxed atomic store
+// As for counters, MetricGaugeSite is the unregistered static of METRIC_SET(n, x)
+class MetricGaugeSite : public Metric {
+public:
+    constexpr MetricGaugeSite(const char* metric_name, const char* metric_help, const SourceLocation& metric_location) : Metric(metric_name, metric_help, metric_location, METRIC_TYPE_GAUGE) {}
+
+    void set(double amount) {
+        bits.store(to_bits(amount), std::memory_order_relaxed);
+    }
+    void add(double amount) {
+        unsigned long long current = bits.load(std::memory_order_relaxed);
+        while (!bits.compare_exchange_weak(current, to_bits(from_bits(current) + amount), std::memory_order_relaxed)) {}
+    }
+    double value() const {
+        return from_bits(bits.load(std::memory_order_relaxed));
+    }
+    // Writes this metric's sample in the Prometheus text format, labelled with its location
+    void write(std::ostream& out) const {
+        out << name;
+        metric_write_labels(out, *this);
+        out << " " << value() << "\n";
+    }
+
+private:
+    // The double is kept as its bits, as atomic floating point addition only arrived in C++20
+    static unsigned long long to_bits(double amount) {
+        unsigned long long result;
+        memcpy(&result, &amount, sizeof(result));
+        return result;
+    }
+    static double from_bits(unsigned long long amount) {
+        double result;
+        memcpy(&result, &amount, sizeof(result));
+        return result;
+    }
+
+    std::atomic<unsigned long long> bits{0}; // 0.0
+};
+
+class MetricGauge : public MetricGaugeSite {
+public:
+    MetricGauge(const char* metric_name, const char* metric_help, const SourceLocation& metric_location) : MetricGaugeSite(metric_name, metric_help, metric_location) {
+        enroll();
+    }
+    ~MetricGauge() {
+        withdraw();
+    }
+};
+
+// A distribution of values, such as latencies in nanoseconds, kept in a LatencyHistogram and exported as a summary of its p50/p90/p99/p99.9
+// As for counters, MetricHistogramSite is the unregistered static of METRIC_RECORD(n, x) and METRIC_TIME(n, x)
+class MetricHistogramSite : public Metric {
+public:
+    constexpr MetricHistogramSite(const char* metric_name, const char* metric_help, const SourceLocation& metric_location) : Metric(metric_name, metric_help, metric_location, METRIC_TYPE_SUMMARY) {}
+
+    void record(unsigned long long amount) {
+        values.record(amount);
+    }
+    LatencyHistogramSnapshot snapshot() const {
+        return values.snapshot();
+    }
+    // The histogram itself, such as for TIME_HISTOGRAM(h, x)
+    LatencyHistogram& histogram() {
+        return values;
+    }
+    // Writes this metric's samples in the Prometheus text format, labelled with its location
+    void write(std::ostream& out) const {
+        LatencyHistogramSnapshot current = values.snapshot();
+        const char* quantiles[] = {"0.5", "0.9", "0.99", "0.999"};
+        const double percents[] = {50.0, 90.0, 99.0, 99.9};
+        for (int i = 0; i < 4; i++) {
+            out << name;
+            metric_write_labels(out, *this, quantiles[i]);
+            out << " " << current.percentile(percents[i]) << "\n";
+        }
+        out << name << "_sum";
+        metric_write_labels(out, *this);
+        out << " " << current.sum << "\n" << name << "_count";
+        metric_write_labels(out, *this);
+        out << " " << current.count << "\n";
+    }
+
+private:
+    LatencyHistogram values;
+};
+
+class MetricHistogram : public MetricHistogramSite {
+public:
+    MetricHistogram(const char* metric_name, const char* metric_help, const SourceLocation& metric_location) : MetricHistogramSite(metric_name, metric_help, metric_location) {
+        enroll();
+    }
+    ~MetricHistogram() {
+        withdraw();
+    }
+};
+
+// Registers the static of a per-line update such as METRIC_ADD(n, x) before main, so that the update itself checks nothing
+// Site is a local class of that line, whose metric() returns the static
+template <typename Site>
+struct MetricEnrollment {
+    static bool enrolled;
+};
+
+template <typename Site>
+bool MetricEnrollment<Site>::enrolled = (Site::metric().enroll(), true);
+
+// Writes every metric in the Prometheus text exposition format, grouped by name, with values at full double precision
+// The list stays locked throughout, so that a metric being destroyed (such as a static at program exit) is never written
+void metrics_write(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(METRICS_MUTEX);
+    std::streamsize precision = out.precision(std::numeric_limits<double>::max_digits10);
+    std::vector<const Metric*> metrics = metrics_registry();
+    std::stable_sort(metrics.begin(), metrics.end(), [](const Metric* a, const Metric* b) {return strcmp(a->name, b->name) < 0;});
+    const char* types[] = {"counter", "gauge", "summary"};
+    for (size_t i = 0; i < metrics.size(); i++) {
+        if (i == 0 || strcmp(metrics[i]->name, metrics[i - 1]->name) != 0) {
+            out << "# HELP " << metrics[i]->name << " " << metrics[i]->help << "\n# TYPE " << metrics[i]->name << " " << types[metrics[i]->type] << "\n";
+        }
+        switch (metrics[i]->type) {
+            case METRIC_TYPE_COUNTER: static_cast<const MetricCounterSite*>(metrics[i])->write(out); break;
+            case METRIC_TYPE_GAUGE: static_cast<const MetricGaugeSite*>(metrics[i])->write(out); break;
+            case METRIC_TYPE_SUMMARY: static_cast<const MetricHistogramSite*>(metrics[i])->write(out); break;
+        }
+    }
+    out.precision(precision);
+}
+
+// Writes every metric to a file, through a temporary file renamed into place so that a scraper never reads a partial snapshot
+// Returns false if the file couldn't be written
+bool metrics_save(const std::string& path) {
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary);
+        if (!out) {
+            return false;
+        }
+        metrics_write(out);
+        if (!out) {
+            return false;
+        }
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+// The background thread of metrics_start_export(path, interval_ms)
+class MetricsExporter {
+public:
+    ~MetricsExporter() {
+        stop();
+    }
+
+    void start(const std::string& export_path, unsigned int interval_ms) {
+        stop();
+        std::lock_guard<std::mutex> lock(mutex);
+        path = export_path;
+        interval = std::chrono::milliseconds(interval_ms);
+        stopping = false;
+        thread = std::thread([this]() {run();});
+    }
+
+    // Stops the thread after one last snapshot
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!thread.joinable()) {
+                return;
+            }
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            bool last = wake.wait_for(lock, interval, [this]() {return stopping;});
+            metrics_save(path);
+            if (last) {
+                return;
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    std::string path;
+    std::chrono::milliseconds interval{1000};
+    bool stopping = false;
+};
+
+// Returns the global metrics exporter, which stops (after one last snapshot) at program exit
+MetricsExporter& metrics_exporter() {
+    static MetricsExporter exporter;
+    return exporter;
+}
+
+// Starts (or restarts) a background thread writing every metric to path each interval_ms milliseconds, see metrics_save(path)
+void metrics_start_export(const std::string& path, unsigned int interval_ms = 1000) {
+    metrics_exporter().start(path, interval_ms);
+}
+
+// Stops the background export thread, after one last snapshot
+void metrics_stop_export() {
+    metrics_exporter().stop();
+}
+
+// Declared metrics are usually globals, where __func__ doesn't exist, so they are labelled with only their file and line
+#define METRIC_COUNTER(var, n, help) MetricCounter var(n, help, SourceLocation{__FILE__, __LINE__, ""});
+#define METRIC_GAUGE(var, n, help) MetricGauge var(n, help, SourceLocation{__FILE__, __LINE__, ""});
+#define METRIC_HISTOGRAM(var, n, help) MetricHistogram var(n, help, SourceLocation{__FILE__, __LINE__, ""});
+// Updates declare their metric as a constant-initialized static (so n must be a string literal), registered before main by MetricEnrollment
+// Each is a single statement needing a trailing ;, so that it also works as the body of an unbraced if or else
+#define METRIC_SITE_IMPL(type, n) static type alexandria_metric(n, "", SOURCE_LOCATION); struct alexandria_metric_site {static Metric& metric() {return alexandria_metric;}}; (void)MetricEnrollment<alexandria_metric_site>::enrolled;
+#define METRIC_ADD(n, x) do {METRIC_SITE_IMPL(MetricCounterSite, n) alexandria_metric.add(x);} while (0)
+#define METRIC_INCREMENT(n) METRIC_ADD(n, 1)
+#define METRIC_SET(n, x) do {METRIC_SITE_IMPL(MetricGaugeSite, n) alexandria_metric.set(x);} while (0)
+#define METRIC_RECORD(n, x) do {METRIC_SITE_IMPL(MetricHistogramSite, n) alexandria_metric.record(x);} while (0)
+#define METRIC_TIME(n, x) do {METRIC_SITE_IMPL(MetricHistogramSite, n) TIME_HISTOGRAM(alexandria_metric.histogram(), x)} while (0)
+
+// Allocation statistics of a thread, or of an ALLOC_SCOPE(n) on it
+struct AllocStats {
+    unsigned long long allocations = 0;
+    unsigned long long bytes = 0; // Total bytes requested
+    unsigned long long frees = 0;
+    unsigned long long freed_bytes = 0;
+    long long live_bytes = 0; // Allocated minus freed on this thread, which goes negative if it frees what other threads allocated
+    long long peak_live_bytes = 0; // Highest live_bytes reached, relative to the start of the scope for ALLOC_SCOPE(n)
+};
+
+// Formats a number of bytes with a binary prefix, such as "512B" or "4.50KiB"
+std::string alloc_format_bytes(double bytes) {
+    const char* prefixes[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int prefix = 0;
+    while (std::abs(bytes) >= 1024.0 && prefix < 4) {
+        bytes /= 1024.0;
+        prefix++;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(prefix == 0 ? 0 : 2) << bytes << prefixes[prefix];
+    return out.str();
+}
+
+#ifdef USE_ALEXANDRIA_ALLOC_TRACKING
+// Heap allocation tracking, through replacements of the global operator new and delete
+// Every block carries a small header holding its size, so that frees can be counted in bytes without a sized delete
+// Over-aligned allocations (C++17 align_val_t overloads) are left to the standard library and aren't counted
+
+// Plain data so that the thread-local needs no constructor, which operator new can't safely wait on
+struct AllocCounters {
+    unsigned long long allocations;
+    unsigned long long bytes;
+    unsigned long long frees;
+    unsigned long long freed_bytes;
+    long long live_bytes;
+    long long peak_live_bytes;
+    bool paused; // Set while reporting, so that printing a scope's results doesn't count towards enclosing scopes
+};
+
+thread_local AllocCounters ALLOC_COUNTERS = {0, 0, 0, 0, 0, 0, false};
+
+// Size of the header in front of every block, kept at the alignment malloc guarantees
+#define ALLOC_HEADER_SIZE (sizeof(std::max_align_t) < sizeof(size_t) ? sizeof(size_t) : sizeof(std::max_align_t))
+
+// Allocates a counted block, returning nullptr on failure, including for a size too large to fit the header
+inline void* alloc_tracked(size_t size) {
+    if (size > SIZE_MAX - ALLOC_HEADER_SIZE) {
+        return nullptr;
+    }
+    void* block = malloc(size + ALLOC_HEADER_SIZE);
+    if (block == nullptr) {
+        return nullptr;
+    }
+    *(size_t*)block = size;
+    AllocCounters& counters = ALLOC_COUNTERS;
+    if (!counters.paused) {
+        counters.allocations++;
+        counters.bytes += size;
+        counters.live_bytes += size;
+        if (counters.live_bytes > counters.peak_live_bytes) {
+            counters.peak_live_bytes = counters.live_bytes;
+        }
+    }
+    return (char*)block + ALLOC_HEADER_SIZE;
+}
+
+// Allocates a counted block, throwing std::bad_alloc (after trying the new handler) on failure, as the standard operator new does
+inline void* alloc_tracked_or_throw(size_t size) {
+    while (true) {
+        void* memory = alloc_tracked(size);
+        if (memory != nullptr) {
+            return memory;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+// Frees a counted block
+inline void alloc_tracked_free(void* memory) {
+    if (memory == nullptr) {
+        return;
+    }
+    void* block = (char*)memory - ALLOC_HEADER_SIZE;
+    AllocCounters& counters = ALLOC_COUNTERS;
+    if (!counters.paused) {
+        size_t size = *(size_t*)block;
+        counters.frees++;
+        counters.freed_bytes += size;
+        counters.live_bytes -= size;
+    }
+    free(block);
+}
+
+void* operator new(size_t size) {return alloc_tracked_or_throw(size);}
+void* operator new[](size_t size) {return alloc_tracked_or_throw(size);}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {return alloc_tracked(size);}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {return alloc_tracked(size);}
+void operator delete(void* memory) noexcept {alloc_tracked_free(memory);}
+void operator delete[](void* memory) noexcept {alloc_tracked_free(memory);}
+void operator delete(void* memory, const std::nothrow_t&) noexcept {alloc_tracked_free(memory);}
+void operator delete[](void* memory, const std::nothrow_t&) noexcept {alloc_tracked_free(memory);}
+void operator delete(void* memory, size_t) noexcept {alloc_tracked_free(memory);}
+void operator delete[](void* memory, size_t) noexcept {alloc_tracked_free(memory);}
+
+// Returns the allocation statistics of the calling thread since it started
+AllocStats alloc_stats() {
+    const AllocCounters& counters = ALLOC_COUNTERS;
+    AllocStats stats;
+    stats.allocations = counters.allocations;
+    stats.bytes = counters.bytes;
+    stats.frees = counters.frees;
+    stats.freed_bytes = counters.freed_bytes;
+    stats.live_bytes = counters.live_bytes;
+    stats.peak_live_bytes = counters.peak_live_bytes;
+    return stats;
+}
+#else
+// Without USE_ALEXANDRIA_ALLOC_TRACKING nothing is counted, and ALLOC_SCOPE(n) does nothing
+AllocStats alloc_stats() {
+    return AllocStats();
+}
+#endif
+
+// AllocStats streaming/printing
+std::ostream& operator << (std::ostream& out, const AllocStats& rhs) {
+    out << rhs.allocations << " allocations (" << alloc_format_bytes(rhs.bytes) << "), " << rhs.frees << " frees (" << alloc_format_bytes(rhs.freed_bytes)
+        << "), peak " << alloc_format_bytes(rhs.peak_live_bytes) << " live";
+    return out;
+}
+
+#ifdef USE_ALEXANDRIA_ALLOC_TRACKING
+// Counts the heap allocations of the calling thread over the enclosing scope, and prints them when it ends, see ALLOC_SCOPE(n)
+class AllocScope {
+public:
+    AllocScope(const char* scope_name, const SourceLocation& scope_location) : name(scope_name), location(scope_location), start(alloc_stats()) {
+        // The peak within this scope is measured from where live bytes are now, and folded back into any enclosing scope's peak at the end
+        ALLOC_COUNTERS.peak_live_bytes = ALLOC_COUNTERS.live_bytes;
+    }
+    ~AllocScope() {
+        AllocStats scope = stats();
+        ALLOC_COUNTERS.peak_live_bytes = std::max(ALLOC_COUNTERS.peak_live_bytes, start.peak_live_bytes);
+        ALLOC_COUNTERS.paused = true;
+        std::cout << T_CYAN << "Ended allocation scope \"" << name << "\" @ " << location << ": " << T_GREEN << scope << T_RESET << std::endl;
+        ALLOC_COUNTERS.paused = false;
+    }
+    AllocScope(const AllocScope&) = delete;
+    AllocScope& operator=(const AllocScope&) = delete;
+
+    // Returns the allocation statistics of this scope so far
+    AllocStats stats() const {
+        AllocStats now = alloc_stats();
+        AllocStats scope;
+        scope.allocations = now.allocations - start.allocations;
+        scope.bytes = now.bytes - start.bytes;
+        scope.frees = now.frees - start.frees;
+        scope.freed_bytes = now.freed_bytes - start.freed_bytes;
+        scope.live_bytes = now.live_bytes - start.live_bytes;
+        scope.peak_live_bytes = now.peak_live_bytes - start.live_bytes;
+        return scope;
+    }
+private:
+    const char* name;
+    SourceLocation location;
+    AllocStats start;
+};
+
+#define ALLOC_SCOPE(n) AllocScope ALEXANDRIA_CONCAT(alexandria_alloc_scope_, __LINE__)(n, SOURCE_LOCATION);
+#else
+#define ALLOC_SCOPE(n)
+#endif
+
+#ifdef USE_ALEXANDRIA_ASYNC_LOG
+// Asynchronous logging, used by LOG/PASS/WARNING/ERROR when USE_ALEXANDRIA_ASYNC_LOG is defined
+// Producers format each message on their own thread into a fixed-size slot of a bounded lock-free queue, and a background thread batches the writes
+
+// Asynchronous logging settings, each of which may be defined before including this file to override it
+#ifndef LOG_QUEUE_SIZE
+#define LOG_QUEUE_SIZE 4096 // Number of messages that can be waiting to be written, must be a power of two
+#endif
+#ifndef LOG_MESSAGE_SIZE
+#define LOG_MESSAGE_SIZE 512 // Maximum length of one message in bytes, longer messages are truncated
+#endif
+
+// What a producer does when the queue is full, see log_set_policy(policy)
+enum LogOverflowPolicy {
+    LOG_BLOCK, // Wait for the writer to make room, so no message is lost (the default)
+    LOG_DROP, // Discard the new message, counting it in log_dropped()
+    LOG_OVERWRITE // Discard the oldest waiting message to make room, counting it in log_dropped()
+};
+
+// One message in the queue. The sequence number says whose turn it is: the producer of position p waits for p, the consumer for p + 1
+struct LogSlot {
+    std::atomic<size_t> sequence;
+    unsigned int length;
+    char text[LOG_MESSAGE_SIZE];
+};
+
+// A stream buffer writing into a fixed array, so that formatting a message never allocates
+class LogMessageBuffer : public std::streambuf {
+public:
+    LogMessageBuffer() {
+        reset();
+    }
+    void reset() {
+        setp(text, text + LOG_MESSAGE_SIZE - 1); // The last byte is kept for the newline of a truncated message
+        truncated = false;
+    }
+    // Returns the message, ending a truncated one with the newline that was cut off
+    const char* data() {
+        if (truncated) {
+            text[LOG_MESSAGE_SIZE - 1] = '\n';
+        }
+        return text;
+    }
+    size_t size() const {
+        return (pptr() - pbase()) + (truncated ? 1 : 0);
+    }
+protected:
+    // Past the end of the array, characters are dropped
+    int_type overflow(int_type c) override {
+        truncated = true;
+        return traits_type::not_eof(c);
+    }
+private:
+    char text[LOG_MESSAGE_SIZE];
+    bool truncated;
+};
+
+// The queue, sinks, and background writer thread of the asynchronous log
+// The queue is a bounded multi-producer multi-consumer ring (after Dmitry Vyukov's design), so that LOG_OVERWRITE producers can also take from it
+class AsyncLog {
+public:
+    AsyncLog() : slots(new LogSlot[LOG_QUEUE_SIZE]) {
+        static_assert((LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) == 0, "LOG_QUEUE_SIZE must be a power of two");
+        for (size_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        writer = std::thread([this]() {run();});
+    }
+    // Writes every waiting message before returning, which also happens for the global log at program exit
+    ~AsyncLog() {
+        stopping.store(true, std::memory_order_seq_cst);
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+        }
+        wake.notify_one();
+        writer.join();
+    }
+    AsyncLog(const AsyncLog&) = delete;
+    AsyncLog& operator=(const AsyncLog&) = delete;
+
+    // Queues a message, following the overflow policy if the queue is full, and wakes the writer if it is waiting for one
+    void push(const char* text, size_t length) {
+        length = std::min(length, (size_t)LOG_MESSAGE_SIZE);
+        while (!try_push(text, length)) {
+            LogOverflowPolicy current = policy.load(std::memory_order_relaxed);
+            if (current == LOG_DROP) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else if (current == LOG_OVERWRITE) {
+                LogSlot* oldest = try_pop_begin();
+                if (oldest != nullptr) {
+                    try_pop_end(oldest);
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    completed.fetch_add(1, std::memory_order_release);
+                }
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        // try_push counted the message with a sequentially consistent increment, so either this sees the writer waiting or the writer sees the message
+        if (sleeping.load(std::memory_order_seq_cst)) {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+            }
+            wake.notify_one();
+        }
+    }
+
+    // Waits until every message queued before this call has been written out and the sinks flushed
+    void flush() {
+        size_t target = enqueued.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        written.wait(lock, [&]() {return flushed.load(std::memory_order_acquire) >= target;});
+    }
+
+    // Sets the file messages are also appended to, or none if the path is empty. Returns false if the file couldn't be opened
+    bool set_file(const std::string& path) {
+        flush();
+        std::lock_guard<std::mutex> lock(sinks_mutex);
+        file.close();
+        file.clear();
+        if (path.empty()) {
+            return true;
+        }
+        file.open(path, std::ios::app | std::ios::binary);
+        return file.is_open();
+    }
+
+    std::atomic<bool> to_stdout{true}; // Whether messages are written to std::cout
+    std::atomic<LogOverflowPolicy> policy{LOG_BLOCK};
+    std::atomic<unsigned long long> dropped{0}; // Messages lost to LOG_DROP or LOG_OVERWRITE
+
+private:
+    // Claims a free slot and fills it, or returns false if the queue is full
+    bool try_push(const char* text, size_t length) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while (true) {
+            LogSlot& slot = slots[position & (LOG_QUEUE_SIZE - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    memcpy(slot.text, text, length);
+                    slot.length = length;
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    enqueued.fetch_add(1, std::memory_order_seq_cst); // Only counted once it can be taken, see push()
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Claims the oldest filled slot, or returns nullptr if the queue is empty. The slot must be released with try_pop_end(slot)
+    LogSlot* try_pop_begin() {
+        size_t position = head.load(std::memory_order_relaxed);
+        while (true) {
+            LogSlot& slot = slots[position & (LOG_QUEUE_SIZE - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    return &slot;
+                }
+            } else if (difference < 0) {
+                return nullptr;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    void try_pop_end(LogSlot* slot) {
+        // The slot's next turn is for the producer one lap later
+        slot->sequence.store(slot->sequence.load(std::memory_order_relaxed) + LOG_QUEUE_SIZE - 1, std::memory_order_release);
+    }
+
+    // The background writer: drains the queue into one batch, then writes and flushes the sinks once per batch
+    // With nothing queued it waits on a condition variable, woken by the next push (or by stopping), so an idle log costs nothing
+    void run() {
+        std::string batch;
+        batch.reserve(LOG_QUEUE_SIZE * 64);
+        while (true) {
+            bool stop = stopping.load(std::memory_order_acquire);
+            size_t count = 0;
+            for (LogSlot* slot = try_pop_begin(); slot != nullptr; slot = try_pop_begin()) {
+                batch.append(slot->text, slot->length);
+                try_pop_end(slot);
+                count++;
+            }
+            if (count > 0) {
+                {
+                    std::lock_guard<std::mutex> lock(sinks_mutex);
+                    if (to_stdout.load(std::memory_order_relaxed)) {
+                        std::cout.write(batch.data(), batch.size());
+                        std::cout.flush();
+                    }
+                    if (file.is_open()) {
+                        file.write(batch.data(), batch.size());
+                        file.flush();
+                    }
+                }
+                batch.clear();
+                completed.fetch_add(count, std::memory_order_release);
+            } else if (stop) {
+                return;
+            }
+            flushed.store(completed.load(std::memory_order_acquire), std::memory_order_release);
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+            }
+            written.notify_all();
+            if (count == 0) {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                sleeping.store(true, std::memory_order_seq_cst);
+                // Messages are waiting while enqueued differs from head. It may also briefly differ for one taken before it was counted, which only wakes the writer early
+                wake.wait(lock, [this]() {
+                    return stopping.load(std::memory_order_seq_cst) || enqueued.load(std::memory_order_seq_cst) != head.load(std::memory_order_relaxed);
+                });
+                sleeping.store(false, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::unique_ptr<LogSlot[]> slots;
+    alignas(64) std::atomic<size_t> tail{0}; // Next position to push to, kept on its own cache line from head
+    alignas(64) std::atomic<size_t> head{0}; // Next position to pop from
+    std::atomic<size_t> enqueued{0}; // Messages ever queued
+    std::atomic<size_t> completed{0}; // Messages ever written out or overwritten
+    std::atomic<size_t> flushed{0}; // Value of completed as of the last time the sinks were flushed
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> sleeping{false}; // Whether the writer is waiting for a message, so that pushes only lock wake_mutex when it is
+    std::mutex wake_mutex; // Guards the waits for the writer below
+    std::condition_variable wake; // Notified when a message is queued for a waiting writer, or when stopping
+    std::condition_variable written; // Notified when the writer has flushed, for flush()
+    std::mutex sinks_mutex; // Guards the file while it is written or swapped
+    std::ofstream file;
+    std::thread writer;
+};
+
+// Returns the global asynchronous log, starting its writer thread on first use
+AsyncLog& async_log() {
+    static AsyncLog log;
+    return log;
+}
+
+// Returns the calling thread's message stream, emptied for a new message
+std::ostream& log_begin() {
+    thread_local LogMessageBuffer buffer;
+    thread_local std::ostream stream(&buffer);
+    buffer.reset();
+    return stream;
+}
+
+// Queues the message formatted into the calling thread's stream since log_begin()
+void log_submit(std::ostream& stream) {
+    LogMessageBuffer* buffer = static_cast<LogMessageBuffer*>(stream.rdbuf());
+    async_log().push(buffer->data(), buffer->size());
+}
+
+// Waits until every message logged so far has been written out
+void log_flush() {
+    async_log().flush();
+}
+
+// Sets what a logging thread does when the queue is full, see LogOverflowPolicy
+void log_set_policy(LogOverflowPolicy policy) {
+    async_log().policy.store(policy, std::memory_order_relaxed);
+}
+
+// Sets whether messages are written to std::cout
+void log_set_stdout(bool enabled) {
+    async_log().to_stdout.store(enabled, std::memory_order_relaxed);
+}
+
+// Sets a file that messages are also appended to, or none if path is empty. Returns false if the file couldn't be opened
+bool log_set_file(const std::string& path) {
+    return async_log().set_file(path);
+}
+
+// Returns the number of messages lost to LOG_DROP or LOG_OVERWRITE so far
+unsigned long long log_dropped() {
+    return async_log().dropped.load(std::memory_order_relaxed);
+}
+
+#endif
+
+#ifdef USE_ALEXANDRIA_BINARY_LOG
+// Binary logging, used by LOG/PASS/WARNING/ERROR when USE_ALEXANDRIA_BINARY_LOG is defined
+// Each call site is registered once as a BinaryLogFormat, then each message is only its format's id and the raw bytes of its values,
+//  copied into a per-thread buffer. Formatting is left to binary_log_decode(in, out), or the alexandria_log_decoder.cpp tool
+// File layout (native byte order): the 8 bytes BINARY_LOG_MAGIC, then records of a 4-byte format id and a 4-byte payload length
+//  The payload of a message is a list of 1-byte BinaryLogType tags each followed by its value
+//  Format id BINARY_LOG_FORMAT_RECORD instead defines a format: its 4-byte id, 1-byte level, 4-byte location length, and location text
+
+// Binary logging settings, each of which may be defined before including this file to override it
+#ifndef BINARY_LOG_BUFFER_SIZE
+#define BINARY_LOG_BUFFER_SIZE 65536 // Bytes of messages buffered per thread before they are written to the file
+#endif
+#ifndef BINARY_LOG_PATH
+#define BINARY_LOG_PATH "alexandria_log.bin" // File written to unless binary_log_open(path) is called first
+#endif
+#define BINARY_LOG_MAGIC "ALXBLOG1"
+#define BINARY_LOG_FORMAT_RECORD 0xFFFFFFFFu
+
+// The type tag in front of each value of a binary message
+enum BinaryLogType : uint8_t {
+    BINARY_LOG_INT, // 8 bytes
+    BINARY_LOG_UINT, // 8 bytes
+    BINARY_LOG_DOUBLE, // 8 bytes, also used for floats
+    BINARY_LOG_CHAR, // 1 byte, also used for signed and unsigned chars as they stream as characters
+    BINARY_LOG_BOOL, // 1 byte
+    BINARY_LOG_POINTER, // 8 bytes
+    BINARY_LOG_STRING, // 4-byte length then the characters, also used for values of any other type, formatted through a stream
+    BINARY_LOG_FORMAT // 4-byte fmtflags, 4-byte precision, 4-byte width, and 1-byte fill, applied to the values after it, see BinaryLogWriter
+};
+
+// A logging call site, registered once so that its messages only need its id
+struct BinaryLogFormat {
+    BinaryLogFormat(int format_level, const SourceLocation& format_location);
+    BinaryLogFormat(const BinaryLogFormat&) = delete;
+    BinaryLogFormat& operator=(const BinaryLogFormat&) = delete;
+
+    uint32_t id;
+    int level;
+    SourceLocation location;
+};
+
+std::mutex BINARY_LOG_MUTEX; // Guards the file and the list of formats
+
+// Returns the binary log file, which is only opened once something is written
+std::ofstream& binary_log_file() {
+    static std::ofstream file;
+    return file;
+}
+
+// Returns every registered format, indexed by id
+std::vector<const BinaryLogFormat*>& binary_log_formats() {
+    static std::vector<const BinaryLogFormat*> formats;
+    return formats;
+}
+
+// Writes a format's definition record. The caller must hold BINARY_LOG_MUTEX
+void binary_log_write_format(std::ofstream& file, const BinaryLogFormat& format) {
+    std::string location = to_string(format.location);
+    uint32_t header[2] = {BINARY_LOG_FORMAT_RECORD, (uint32_t)(4 + 1 + 4 + location.size())};
+    uint8_t level = (uint8_t)format.level;
+    uint32_t location_length = location.size();
+    file.write((const char*)header, sizeof(header));
+    file.write((const char*)&format.id, 4);
+    file.write((const char*)&level, 1);
+    file.write((const char*)&location_length, 4);
+    file.write(location.data(), location.size());
+}
+
+// Opens a file for the binary log, starting it with every format registered so far. The caller must hold BINARY_LOG_MUTEX
+bool binary_log_open_locked(const std::string& path) {
+    std::ofstream& file = binary_log_file();
+    file.close();
+    file.clear();
+    file.open(path, std::ios::binary | std::ios::trunc);
+    file.write(BINARY_LOG_MAGIC, 8);
+    for (const BinaryLogFormat* format : binary_log_formats()) {
+        binary_log_write_format(file, *format);
+    }
+    return (bool)file;
+}
+
+// Starts writing the binary log to a new file (BINARY_LOG_PATH otherwise). Returns false if it couldn't be opened
+// Messages still buffered by other threads are written to the new file once those threads flush
+bool binary_log_open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(BINARY_LOG_MUTEX);
+    return binary_log_open_locked(path);
+}
+
+BinaryLogFormat::BinaryLogFormat(int format_level, const SourceLocation& format_location) : level(format_level), location(format_location) {
+    std::lock_guard<std::mutex> lock(BINARY_LOG_MUTEX);
+    id = binary_log_formats().size();
+    binary_log_formats().push_back(this);
+    if (binary_log_file().is_open()) {
+        binary_log_write_format(binary_log_file(), *this);
+    }
+}
+
+// Appends whole records to the file, opening BINARY_LOG_PATH if no file was opened yet
+void binary_log_write(const char* data, size_t size) {
+    std::lock_guard<std::mutex> lock(BINARY_LOG_MUTEX);
+    if (!binary_log_file().is_open()) {
+        binary_log_open_locked(BINARY_LOG_PATH);
+    }
+    binary_log_file().write(data, size);
+}
+
+// A thread's buffer of binary messages, written out when full, by binary_log_flush(), and when the thread exits
+class BinaryLogBuffer {
+public:
+    ~BinaryLogBuffer() {
+        flush();
+    }
+
+    // Starts a message, reserving room for its length
+    void begin(uint32_t id) {
+        if (BINARY_LOG_BUFFER_SIZE - size < 64) {
+            flush();
+        }
+        record = size;
+        put(&id, 4);
+        size += 4;
+    }
+
+    // Completes a message by filling in its length
+    void end() {
+        uint32_t length = size - record - 8;
+        memcpy(data + record + 4, &length, 4);
+        record = size;
+    }
+
+    // Appends a tagged value, which is dropped if it can't fit in an empty buffer
+    void put(uint8_t type, const void* value, size_t length) {
+        if (reserve(1 + length)) {
+            data[size++] = type;
+            put(value, length);
+        }
+    }
+
+    // Appends a tagged string, truncated to what fits in an empty buffer
+    void put_string(const char* text, size_t length) {
+        if (reserve(1 + 4 + 1)) {
+            length = std::min(length, (size_t)(BINARY_LOG_BUFFER_SIZE - size - 1 - 4));
+            uint32_t length32 = length;
+            data[size++] = BINARY_LOG_STRING;
+            put(&length32, 4);
+            put(text, length);
+        }
+    }
+
+    // Writes out every completed message
+    void flush() {
+        if (record > 0) {
+            binary_log_write(data, record);
+            memmove(data, data + record, size - record);
+            size -= record;
+            record = 0;
+        }
+    }
+
+private:
+    void put(const void* value, size_t length) {
+        memcpy(data + size, value, length);
+        size += length;
+    }
+
+    // Makes room for more of the current message by writing out the completed ones, returning false if there still isn't room
+    bool reserve(size_t length) {
+        if (size + length > BINARY_LOG_BUFFER_SIZE) {
+            flush();
+        }
+        return size + length <= BINARY_LOG_BUFFER_SIZE;
+    }
+
+    char data[BINARY_LOG_BUFFER_SIZE];
+    size_t size = 0;
+    size_t record = 0; // Start of the message being written, everything before it is complete
+};
+
+// Returns the calling thread's binary log buffer
+BinaryLogBuffer& binary_log_local_buffer() {
+    thread_local BinaryLogBuffer buffer;
+    return buffer;
+}
+
+// Returns the calling thread's stream that manipulators (and values of other types) are applied to, reset to the default format
+std::ostringstream& binary_log_local_format() {
+    thread_local std::ostringstream format;
+    format.str(std::string());
+    format.flags(std::ios_base::dec | std::ios_base::skipws);
+    format.precision(6);
+    format.width(0);
+    format.fill(' ');
+    return format;
+}
+
+// Appends the values of a message to the calling thread's buffer, in place of a stream
+// Manipulators such as std::hex or std::setprecision(3) are applied to a real stream, and whenever its format differs from the one last
+//  recorded a BINARY_LOG_FORMAT value is appended, so the decoder prints each value as the stream would have
+// The format starts as the default for each message, rather than carrying over from the previous one as it would on std::cout, and the stream
+//  is only touched once a message uses a manipulator or a value of another type, so plain messages stay as cheap as copying their values
+class BinaryLogWriter {
+public:
+    explicit BinaryLogWriter(BinaryLogBuffer& writer_buffer) : buffer(writer_buffer) {}
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value && (sizeof(T) > 1), BinaryLogWriter&>::type operator << (T value) {
+        int64_t widened = value;
+        record_format();
+        buffer.put(BINARY_LOG_INT, &widened, 8);
+        return *this;
+    }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value && (sizeof(T) > 1), BinaryLogWriter&>::type operator << (T value) {
+        uint64_t widened = value;
+        record_format();
+        buffer.put(BINARY_LOG_UINT, &widened, 8);
+        return *this;
+    }
+    BinaryLogWriter& operator << (double value) {
+        record_format();
+        buffer.put(BINARY_LOG_DOUBLE, &value, 8);
+        return *this;
+    }
+    BinaryLogWriter& operator << (float value) {
+        return *this << (double)value;
+    }
+    // Formatted at the call site, as a double would lose its extra precision
+    BinaryLogWriter& operator << (long double value) {
+        format_stream() << value;
+        return record_formatted();
+    }
+    BinaryLogWriter& operator << (char value) {
+        record_format();
+        buffer.put(BINARY_LOG_CHAR, &value, 1);
+        return *this;
+    }
+    BinaryLogWriter& operator << (signed char value) {
+        return *this << (char)value;
+    }
+    BinaryLogWriter& operator << (unsigned char value) {
+        return *this << (char)value;
+    }
+    BinaryLogWriter& operator << (bool value) {
+        record_format();
+        buffer.put(BINARY_LOG_BOOL, &value, 1);
+        return *this;
+    }
+    BinaryLogWriter& operator << (const void* value) {
+        uint64_t address = (uint64_t)(uintptr_t)value;
+        record_format();
+        buffer.put(BINARY_LOG_POINTER, &address, 8);
+        return *this;
+    }
+    BinaryLogWriter& operator << (const char* text) {
+        record_format();
+        buffer.put_string(text, strlen(text));
+        return *this;
+    }
+    BinaryLogWriter& operator << (const std::string& text) {
+        record_format();
+        buffer.put_string(text.data(), text.size());
+        return *this;
+    }
+    // Printed as C++17 streams print it, as streaming nullptr doesn't compile before then
+    BinaryLogWriter& operator << (std::nullptr_t) {
+        return *this << "nullptr";
+    }
+
+    BinaryLogWriter& operator << (const LogSuppressed& suppressed) {
+        if (suppressed.count > 0) {
+            *this << " (suppressed " << suppressed.count << " messages from this call site since the last printed)";
+        }
+        return *this;
+    }
+
+    // Manipulators are applied to the format stream, and anything they print (such as the newline of std::endl) is kept as text
+    BinaryLogWriter& operator << (std::ios_base& (*manipulator)(std::ios_base&)) {
+        format_stream() << manipulator;
+        return *this;
+    }
+    BinaryLogWriter& operator << (std::ios& (*manipulator)(std::ios&)) {
+        format_stream() << manipulator;
+        return *this;
+    }
+    BinaryLogWriter& operator << (std::ostream& (*manipulator)(std::ostream&)) {
+        format_stream() << manipulator;
+        return record_formatted();
+    }
+
+    // Anything else is formatted at the call site with the current format, which is slower but prints the same
+    // This includes manipulators that take arguments, such as std::setprecision(3), which print nothing but change the format
+    template <typename T>
+    typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_pointer<T>::value, BinaryLogWriter&>::type operator << (const T& value) {
+        format_stream() << value;
+        return record_formatted();
+    }
+
+private:
+    // Returns the format stream, taking and resetting the calling thread's on first use
+    std::ostringstream& format_stream() {
+        if (format == nullptr) {
+            format = &binary_log_local_format();
+        }
+        return *format;
+    }
+
+    // Appends the format stream's format if it changed since it was last appended (or from the default, at the start of a message)
+    void record_format() {
+        if (format == nullptr) {
+            return;
+        }
+        if (format->flags() != flags || format->precision() != precision || format->width() != width || format->fill() != fill) {
+            flags = format->flags();
+            precision = format->precision();
+            width = format->width();
+            fill = format->fill();
+            char value[13];
+            uint32_t flags32 = (uint32_t)flags;
+            int32_t precision32 = (int32_t)precision;
+            int32_t width32 = (int32_t)width;
+            memcpy(value, &flags32, 4);
+            memcpy(value + 4, &precision32, 4);
+            memcpy(value + 8, &width32, 4);
+            value[12] = fill;
+            buffer.put(BINARY_LOG_FORMAT, value, 13);
+        }
+        // Any value resets the width after printing, on a stream and so in the decoder
+        format->width(0);
+        width = 0;
+    }
+
+    // Appends whatever was printed into the format stream as text, which is already padded to the width
+    BinaryLogWriter& record_formatted() {
+        std::string text = format->str();
+        if (!text.empty()) {
+            format->width(0);
+            record_format();
+            buffer.put_string(text.data(), text.size());
+            format->str(std::string());
+        }
+        return *this;
+    }
+
+    BinaryLogBuffer& buffer;
+    std::ostringstream* format = nullptr; // The format stream, once a manipulator or another type is used
+    std::ios_base::fmtflags flags = std::ios_base::dec | std::ios_base::skipws;
+    std::streamsize precision = 6;
+    std::streamsize width = 0;
+    char fill = ' ';
+};
+
+// Starts a binary message of a format in the calling thread's buffer
+inline BinaryLogWriter binary_log_begin(const BinaryLogFormat& format) {
+    BinaryLogBuffer& buffer = binary_log_local_buffer();
+    buffer.begin(format.id);
+    return BinaryLogWriter(buffer);
+}
+
+// Completes the calling thread's current binary message
+inline void binary_log_end() {
+    binary_log_local_buffer().end();
+}
+
+// Writes the calling thread's buffered messages to the file, and flushes it. Other threads' messages are written when they flush or exit
+void binary_log_flush() {
+    binary_log_local_buffer().flush();
+    std::lock_guard<std::mutex> lock(BINARY_LOG_MUTEX);
+    binary_log_file().flush();
+}
+
+// Reads a value of a binary log, returning false if the log ends first
+template <typename T>
+bool binary_log_read(std::istream& in, T& value) {
+    return (bool)in.read((char*)&value, sizeof(T));
+}
+
+// Decodes a binary log back into the text LOG/PASS/WARNING/ERROR would have printed, optionally with the location of each message
+// Returns false if the log is malformed or cut off, after decoding as much of it as possible
+bool binary_log_decode(std::istream& in, std::ostream& out, bool show_locations = false) {
+    char magic[8];
+    if (!in.read(magic, 8) || memcmp(magic, BINARY_LOG_MAGIC, 8) != 0) {
+        return false;
+    }
+    std::map<uint32_t, std::pair<int, std::string>> formats; // Level and location of each format id
+    uint32_t header[2];
+    while (binary_log_read(in, header)) {
+        if (header[0] == BINARY_LOG_FORMAT_RECORD) {
+            uint32_t id;
+            uint8_t level;
+            uint32_t location_length;
+            if (!binary_log_read(in, id) || !binary_log_read(in, level) || !binary_log_read(in, location_length)) {
+                return false;
+            }
+            std::string location(location_length, '\0');
+            if (!in.read(&location[0], location_length)) {
+                return false;
+            }
+            formats[id] = std::make_pair((int)level, location);
+            continue;
+        }
+        std::map<uint32_t, std::pair<int, std::string>>::const_iterator format = formats.find(header[0]);
+        if (format == formats.end()) {
+            return false;
+        }
+        switch (format->second.first) {
+            case LOG_LEVEL_ERROR: out << T_RED << "ERROR: " << T_RESET; break;
+            case LOG_LEVEL_WARNING: out << T_YELLOW << "WARNING: " << T_RESET; break;
+            case LOG_LEVEL_PASS: out << T_GREEN << "PASS: " << T_RESET; break;
+            default: out << T_BLUE << "LOG: " << T_RESET; break;
+        }
+        // Each message starts in the default format, and out is left as it was found
+        std::ios_base::fmtflags saved_flags = out.flags(std::ios_base::dec | std::ios_base::skipws);
+        std::streamsize saved_precision = out.precision(6);
+        char saved_fill = out.fill(' ');
+        out.width(0);
+        uint32_t remaining = header[1];
+        while (remaining > 0) {
+            uint8_t type;
+            if (!binary_log_read(in, type)) {
+                return false;
+            }
+            remaining -= 1;
+            if (type == BINARY_LOG_FORMAT) {
+                uint32_t flags;
+                int32_t precision;
+                int32_t width;
+                char fill;
+                if (remaining < 13 || !binary_log_read(in, flags) || !binary_log_read(in, precision) || !binary_log_read(in, width) || !binary_log_read(in, fill)) {
+                    return false;
+                }
+                remaining -= 13;
+                out.flags((std::ios_base::fmtflags)flags);
+                out.precision(precision);
+                out.width(width);
+                out.fill(fill);
+            } else if (type == BINARY_LOG_CHAR || type == BINARY_LOG_BOOL) {
+                char value;
+                if (remaining < 1 || !binary_log_read(in, value)) {
+                    return false;
+                }
+                remaining -= 1;
+                if (type == BINARY_LOG_CHAR) {
+                    out << value;
+                } else {
+                    out << (bool)value;
+                }
+            } else if (type == BINARY_LOG_STRING) {
+                uint32_t length;
+                if (remaining < 4 || !binary_log_read(in, length) || remaining - 4 < length) {
+                    return false;
+                }
+                std::string text(length, '\0');
+                if (!in.read(&text[0], length)) {
+                    return false;
+                }
+                remaining -= 4 + length;
+                out << text;
+            } else {
+                uint64_t value;
+                if (remaining < 8 || !binary_log_read(in, value)) {
+                    return false;
+                }
+                remaining -= 8;
+                if (type == BINARY_LOG_INT) {
+                    out << (int64_t)value;
+                } else if (type == BINARY_LOG_UINT) {
+                    out << value;
+                } else if (type == BINARY_LOG_DOUBLE) {
+                    double number;
+                    memcpy(&number, &value, 8);
+                    out << number;
+                } else if (type == BINARY_LOG_POINTER) {
+                    out << (const void*)(uintptr_t)value;
+                } else {
+                    return false;
+                }
+            }
+        }
+        out.flags(saved_flags);
+        out.precision(saved_precision);
+        out.fill(saved_fill);
+        out.width(0);
+        if (show_locations) {
+            out << " @ " << format->second.second;
+        }
+        out << '\n';
+    }
+    return in.eof();
+}
+#endif
+
+// Returns every rate-limited call site that has suppressed a message
+std::vector<LogRateLimit*>& log_rate_limit_registry() {
+    static std::vector<LogRateLimit*> registry;
+    return registry;
+}
+
+std::mutex LOG_RATE_LIMIT_MUTEX; // Guards the list of rate-limited call sites
+
+#if defined(DEBUG) && defined(USE_ALEXANDRIA_BINARY_LOG)
+// The format of suppressed-message summaries, registered along with the first call site to suppress one
+const BinaryLogFormat& log_suppressed_format() {
+    static const BinaryLogFormat format(LOG_LEVEL_WARNING, SOURCE_LOCATION);
+    return format;
+}
+#endif
+
+// Writes a WARNING that a call site suppressed count messages after the last it printed
+void log_suppressed_write(const LogRateLimit& limit, unsigned long long count) {
+#if defined(DEBUG) && defined(USE_ALEXANDRIA_BINARY_LOG)
+    // Through a buffer of its own, as at exit the thread's buffer may already be gone. Its destructor writes it out
+    std::unique_ptr<BinaryLogBuffer> buffer(new BinaryLogBuffer());
+    buffer->begin(log_suppressed_format().id);
+    BinaryLogWriter(*buffer) << "Suppressed " << count << " messages from " << to_string(limit.location) << " after the last printed";
+    buffer->end();
+#elif defined(DEBUG) && defined(USE_ALEXANDRIA_ASYNC_LOG)
+    std::ostringstream message; // Rather than log_begin(), whose per-thread stream may already be gone at exit
+    message << T_YELLOW << "WARNING: " << T_RESET << "Suppressed " << count << " messages from " << limit.location << " after the last printed\n";
+    std::string text = message.str();
+    async_log().push(text.data(), text.size());
+#elif defined(DEBUG)
+    std::cout << T_YELLOW << "WARNING: " << T_RESET << "Suppressed " << count << " messages from " << limit.location << " after the last printed" << std::endl;
+#else
+    (void)limit;
+    (void)count;
+#endif
+}
+
+// Writes a WARNING for each rate-limited call site that suppressed messages since it last printed one (or since the last summary)
+// Called by LOG_FLUSH() and at exit. Counts are exact once other threads have stopped logging, and approximate while they do
+void log_rate_limit_summary() {
+    std::lock_guard<std::mutex> lock(LOG_RATE_LIMIT_MUTEX);
+    for (LogRateLimit* limit : log_rate_limit_registry()) {
+        unsigned long long count = limit->count.load(std::memory_order_relaxed);
+        // Start of the messages suppressed since the last printed one, which was WARNING_RATE_LIMIT_FIRST - 1 plus a multiple of WARNING_RATE_LIMIT_EVERY
+        unsigned long long first = WARNING_RATE_LIMIT_FIRST + (count - WARNING_RATE_LIMIT_FIRST) / WARNING_RATE_LIMIT_EVERY * WARNING_RATE_LIMIT_EVERY;
+        first = std::max(first, limit->summarized.load(std::memory_order_relaxed));
+        if (count > first) {
+            log_suppressed_write(*limit, count - first);
+        }
+        limit->summarized.store(count, std::memory_order_relaxed);
+    }
+}
+
+// Writes the last summary at exit. Constructed after the log it writes to, so that it is destroyed first
+struct LogRateLimitExit {
+    ~LogRateLimitExit() {
+        log_rate_limit_summary();
+    }
+};
+
+// Everything the exit summary uses is created before it, so that it's still there when the summary is destroyed
+void log_rate_limit_enroll(LogRateLimit& limit) {
+    log_rate_limit_registry();
+#if defined(DEBUG) && defined(USE_ALEXANDRIA_BINARY_LOG)
+    log_suppressed_format();
+    binary_log_file();
+#elif defined(DEBUG) && defined(USE_ALEXANDRIA_ASYNC_LOG)
+    async_log();
+#endif
+    static LogRateLimitExit exit_summary;
+    std::lock_guard<std::mutex> lock(LOG_RATE_LIMIT_MUTEX);
+    log_rate_limit_registry().push_back(&limit);
+}
+
+#if defined(USE_ALEXANDRIA_BINARY_LOG)
+#define LOG_FLUSH() {binary_log_local_buffer().flush(); log_rate_limit_summary(); binary_log_flush();}
+#elif defined(USE_ALEXANDRIA_ASYNC_LOG)
+#define LOG_FLUSH() {log_rate_limit_summary(); log_flush();}
+#else
+#define LOG_FLUSH() {log_rate_limit_summary(); std::cout << std::flush;}
+#endif
+
+// Begin Alexandria namespace
+#ifdef USE_ALEXANDRIA_NAMESPACE
+namespace Alexandria {
+#endif
+
+////////// STRUCTS //////////
+
+// A vector of N components of type T, such as Vec<3, float>. Point2, Point3, and Vector3 are aliases of it, see below
+// Components are named x, y, z, and w for N up to 4, and indexed with [] for any N. The types are plain aggregates without padding, so they
+//  brace-initialize, copy, and pack into arrays as the hand-written structs they replaced did
+// Every operation is constexpr, and is a loop over a constant number of components that the compiler unrolls and vectorizes for any T
+template <size_t N, typename T>
+struct Vec {
+    typedef T value_type;
+    T values[N];
+
+    constexpr const T& operator[](size_t i) const {return values[i];}
+    constexpr T& operator[](size_t i) {return values[i];}
+};
+
+template <typename T>
+struct Vec<2, T> {
+    typedef T value_type;
+    T x;
+    T y;
+
+    constexpr const T& operator[](size_t i) const {return i == 0 ? x : y;}
+    constexpr T& operator[](size_t i) {return i == 0 ? x : y;}
+};
+
+template <typename T>
+struct Vec<3, T> {
+    typedef T value_type;
+    T x;
+    T y;
+    T z;
+
+    constexpr const T& operator[](size_t i) const {return i == 0 ? x : i == 1 ? y : z;}
+    constexpr T& operator[](size_t i) {return i == 0 ? x : i == 1 ? y : z;}
+
+    // Common swizzles, see swizzle<...>(v) for any other
+    constexpr Vec<2, T> xy() const {return {x, y};}
+    constexpr Vec<2, T> xz() const {return {x, z};}
+    constexpr Vec<2, T> yz() const {return {y, z};}
+};
+
+template <typename T>
+struct Vec<4, T> {
+    typedef T value_type;
+    T x;
+    T y;
+    T z;
+    T w;
+
+    constexpr const T& operator[](size_t i) const {return i == 0 ? x : i == 1 ? y : i == 2 ? z : w;}
+    constexpr T& operator[](size_t i) {return i == 0 ? x : i == 1 ? y : i == 2 ? z : w;}
+
+    // Common swizzles, see swizzle<...>(v) for any other
+    constexpr Vec<2, T> xy() const {return {x, y};}
+    constexpr Vec<3, T> xyz() const {return {x, y, z};}
+};
+
+// Points of any size and component type, the same as Vec<N, T>
+template <size_t N, typename T>
+using Point = Vec<N, T>;
+
+// Ultra-basic 2D and 3D points (of integers)
+typedef Vec<2, int> Point2;
+typedef Vec<3, int> Point3;
+
+// Basic floating-point vectors
+typedef Vec<2, float> Vector2;
+typedef Vec<3, float> Vector3;
+typedef Vec<4, float> Vector4;
+typedef Vec<3, double> Vector3d;
+#ifdef __FLT16_MAX__
+typedef Vec<3, _Float16> Vector3h; // Half precision, where the compiler supports _Float16
+#endif
+
+// Enables a scalar operator of Vec<N, T> for scalars of type S, which are converted to T: any that converts, except a floating-point scalar
+//  for integer components, whose fraction would be silently dropped (so Point3{1, 2, 3} * 2.5 doesn't compile, rather than giving (2, 4, 6))
+template <typename T, typename S>
+using VecScalar = typename std::enable_if<std::is_convertible<S, T>::value && !(std::is_integral<T>::value && std::is_floating_point<S>::value), T>::type;
+
+// Vec arithmetic, component by component. Scalars are converted to the component type, so Vector3 * 2 and Point3 * 2 both work
+// Results are cast back to T, so that small integer and half-precision components don't widen
+template <size_t N, typename T>
+constexpr Vec<N, T> operator + (const Vec<N, T>& lhs, const Vec<N, T>& rhs) {
+    Vec<N, T> result{};
+    for (size_t i = 0; i < N; i++) {
+        result[i] = static_cast<T>(lhs[i] + rhs[i]);
+    }
+    return result;
+}
+template <size_t N, typename T>
+constexpr Vec<N, T> operator - (const Vec<N, T>& lhs, const Vec<N, T>& rhs) {
+    Vec<N, T> result{};
+    for (size_t i = 0; i < N; i++) {
+        result[i] = static_cast<T>(lhs[i] - rhs[i]);
+    }
+    return result;
+}
+template <size_t N, typename T>
+constexpr Vec<N, T> operator - (const Vec<N, T>& rhs) {
+    Vec<N, T> result{};
+    for (size_t i = 0; i < N; i++) {
+        result[i] = static_cast<T>(-rhs[i]);
+    }
+    return result;
+}
+template <size_t N, typename T, typename S>
+constexpr Vec<N, VecScalar<T, S>> operator * (const Vec<N, T>& lhs, S scalar) {
+    Vec<N, T> result{};
+    for (size_t i = 0; i < N; i++) {
+        result[i] = static_cast<T>(lhs[i] * static_cast<T>(scalar));
+    }
+    return result;
+}
+template <size_t N, typename T, typename S>
+constexpr Vec<N, VecScalar<T, S>> operator * (S scalar, const Vec<N, T>& rhs) {
+    return rhs * scalar;
+}
+template <size_t N, typename T, typename S>
+constexpr Vec<N, VecScalar<T, S>> operator / (const Vec<N, T>& lhs, S scalar) {
+    Vec<N, T> result{};
+    for (size_t i = 0; i < N; i++) {
+        result[i] = static_cast<T>(lhs[i] / static_cast<T>(scalar));
+    }
+    return result;
+}
+template <size_t N, typename T>
+constexpr Vec<N, T>& operator += (Vec<N, T>& lhs, const Vec<N, T>& rhs) {return lhs = lhs + rhs;}
+template <size_t N, typename T>
+constexpr Vec<N, T>& operator -= (Vec<N, T>& lhs, const Vec<N, T>& rhs) {return lhs = lhs - rhs;}
+template <size_t N, typename T, typename S>
+constexpr Vec<N, VecScalar<T, S>>& operator *= (Vec<N, T>& lhs, S scalar) {return lhs = lhs * scalar;}
+template <size_t N, typename T, typename S>
+constexpr Vec<N, VecScalar<T, S>>& operator /= (Vec<N, T>& lhs, S scalar) {return lhs = lhs / scalar;}
+
+template <size_t N, typename T>
+constexpr bool operator == (const Vec<N, T>& lhs, const Vec<N, T>& rhs) {
+    for (size_t i = 0; i < N; i++) {
+        if (lhs[i] != rhs[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+template <size_t N, typename T>
+constexpr bool operator != (const Vec<N, T>& lhs, const Vec<N, T>& rhs) {return !(lhs == rhs);}
+
+// Returns the dot product of two Vec
+template <size_t N, typename T>
+constexpr T dot(const Vec<N, T>& lhs, const Vec<N, T>& rhs) {
+    T sum = lhs[0] * rhs[0];
+    for (size_t i = 1; i < N; i++) {
+        sum = static_cast<T>(sum + lhs[i] * rhs[i]);
+    }
+    return sum;
+}
+
+// Returns the squared length of a Vec, which needs no square root and so is exact for integers
+template <size_t N, typename T>
+constexpr T length_squared(const Vec<N, T>& v) {return dot(v, v);}
+
+// Returns the cross product of two 3D Vec
+template <typename T>
+constexpr Vec<3, T> cross(const Vec<3, T>& lhs, const Vec<3, T>& rhs) {
+    return {static_cast<T>(lhs.y * rhs.z - lhs.z * rhs.y), static_cast<T>(lhs.z * rhs.x - lhs.x * rhs.z), static_cast<T>(lhs.x * rhs.y - lhs.y * rhs.x)};
+}
+
+// Whether every index of a swizzle is a component of an N-component Vec
+template <size_t N>
+constexpr bool vec_indices_below() {return true;}
+template <size_t N, size_t First, size_t... Rest>
+constexpr bool vec_indices_below() {return First < N && vec_indices_below<N, Rest...>();}
+
+// Returns the given components of a Vec, in order and possibly repeated, such as swizzle<2, 1, 0>(v) for <z, y, x> or swizzle<0, 0>(v) for <x, x>
+template <size_t... I, size_t N, typename T>
+constexpr Vec<sizeof...(I), T> swizzle(const Vec<N, T>& v) {
+    static_assert(vec_indices_below<N, I...>(), "swizzle indices must be components of the vector");
+    return {v[I]...};
+}
+
+// Returns a Vec with each component converted to another type, such as vec_cast<float>(point) to turn a Point3 into a Vector3
+template <typename U, size_t N, typename T>
+constexpr Vec<N, U> vec_cast(const Vec<N, T>& v) {
+    Vec<N, U> result{};
+    for (size_t i = 0; i < N; i++) {
+        result[i] = static_cast<U>(v[i]);
+    }
+    return result;
+}
+
+// Prints one component of a Vec, with small integers as numbers rather than characters
+template <typename T>
+void vec_print_component(std::ostream& out, const T& value) {
+    out << +value;
+}
+#ifdef __FLT16_MAX__
+inline void vec_print_component(std::ostream& out, const _Float16& value) {
+    out << static_cast<float>(value);
+}
+#endif
+
+// Vec streaming/printing: points of integers as (x, y, z), and floating-point vectors as <x, y, z>
+template <size_t N, typename T>
+std::ostream& operator << (std::ostream& out, const Vec<N, T>& rhs) {
+    out << (std::is_integral<T>::value ? "(" : "<");
+    for (size_t i = 0; i < N; i++) {
+        out << (i ? ", " : "");
+        vec_print_component(out, rhs[i]);
+    }
+    out << (std::is_integral<T>::value ? ")" : ">");
+    return out;
+}
+
+// Vector-matrix functions
+Vector3 operator*(std::vector<std::vector<float>> const& lhs, Vector3 const& rhs) {
+    // Throw an error if the vector is not the right size
+    if (lhs.size() != 3 || lhs[0].size() != 3) {
+        throw std::invalid_argument("Vector3 matrix multiplication only defined for 3x3 floating-point matrices.");
+    }
+
+    return (Vector3){
+        lhs[0][0]*rhs.x + lhs[1][0]*rhs.y + lhs[2][0]*rhs.z,
+        lhs[0][1]*rhs.x + lhs[1][1]*rhs.y + lhs[2][1]*rhs.z,
+        lhs[0][2]*rhs.x + lhs[1][2]*rhs.y + lhs[2][2]*rhs.z,
+    };
+}
+
+// Vector 3 math source: audeo C++ library
+// Returns the magnitude of a Vector3
+float magnitude(Vector3 v) {
+    return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+}
+
+// Returns a normalized Vector3
+Vector3 normalize(Vector3 v) { return v * (1.0f / magnitude(v)); }
+
+// Returns the angle between two Vector3
+float angle(Vector3 const& lhs, Vector3 const& rhs) {
+    // The cosine of the angle between two vectors is equal to the dot product
+    // of the vectors divided by the product of the magnitude of the vectors
+    //
+    // We get rid of the division by normalizing the vectors
+    Vector3 a = normalize(lhs);
+    Vector3 b = normalize(rhs);
+    // The cosine is now equal to the dot product of a and b
+    float cos_a = dot(a, b);
+    // Convert this cosine to an angle in degrees and we are done
+    return static_cast<float>(std::acos(cos_a) * 180.0f / M_PI);
+}
+
+// A 3x3 floating-point matrix, stored contiguously in row-major order so that it lives on the stack and copies as a plain value
+// Element (row, column) is m[row * 3 + column], also available as matrix(row, column). Vectors are columns, so a transform applies as matrix * vector
+struct Matrix3 {
+    float m[9];
+
+    constexpr float operator()(int row, int column) const {return m[row * 3 + column];}
+    constexpr float& operator()(int row, int column) {return m[row * 3 + column];}
+
+    // Returns the identity matrix
+    static constexpr Matrix3 identity() {
+        return Matrix3{{1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f}};
+    }
+
+    // Returns a matrix that scales each axis by the matching component of factors
+    static constexpr Matrix3 scaling(Vector3 factors) {
+        return Matrix3{{factors.x, 0.0f, 0.0f, 0.0f, factors.y, 0.0f, 0.0f, 0.0f, factors.z}};
+    }
+
+    // Returns a matrix that rotates counterclockwise (right-handed) by degrees around an axis, which doesn't need to be normalized
+    static Matrix3 rotation(Vector3 axis, float degrees) {
+        Vector3 a = normalize(axis);
+        float radians = static_cast<float>(degrees * M_PI / 180.0);
+        float c = std::cos(radians);
+        float s = std::sin(radians);
+        float t = 1.0f - c;
+        return Matrix3{{
+            t * a.x * a.x + c, t * a.x * a.y - s * a.z, t * a.x * a.z + s * a.y,
+            t * a.x * a.y + s * a.z, t * a.y * a.y + c, t * a.y * a.z - s * a.x,
+            t * a.x * a.z - s * a.y, t * a.y * a.z + s * a.x, t * a.z * a.z + c,
+        }};
+    }
+    static Matrix3 rotation_x(float degrees) {return rotation({1.0f, 0.0f, 0.0f}, degrees);}
+    static Matrix3 rotation_y(float degrees) {return rotation({0.0f, 1.0f, 0.0f}, degrees);}
+    static Matrix3 rotation_z(float degrees) {return rotation({0.0f, 0.0f, 1.0f}, degrees);}
+
+    // Converts from a 3x3 matrix of make_matrix_3x3(), throwing std::invalid_argument for any other shape
+    // That matrix is indexed as nested[column][row] by its operator * with a Vector3, so the result transforms vectors the same way
+    static Matrix3 from_nested(const std::vector<std::vector<float>>& nested) {
+        if (nested.size() != 3 || nested[0].size() != 3 || nested[1].size() != 3 || nested[2].size() != 3) {
+            throw std::invalid_argument("Matrix3 conversion only defined for 3x3 floating-point matrices.");
+        }
+        Matrix3 result{};
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++) {
+                result(row, column) = nested[column][row];
+            }
+        }
+        return result;
+    }
+
+    // Converts to the nested[column][row] layout of make_matrix_3x3(), the reverse of from_nested()
+    std::vector<std::vector<float>> to_nested() const {
+        std::vector<std::vector<float>> nested(3, std::vector<float>(3));
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++) {
+                nested[column][row] = (*this)(row, column);
+            }
+        }
+        return nested;
+    }
+};
+
+// Matrix3 streaming/printing, one bracketed row after another
+std::ostream& operator << (std::ostream& out, const Matrix3& rhs) {
+    out << "[[" << rhs(0, 0) << ", " << rhs(0, 1) << ", " << rhs(0, 2) << "], [" << rhs(1, 0) << ", " << rhs(1, 1) << ", " << rhs(1, 2)
+        << "], [" << rhs(2, 0) << ", " << rhs(2, 1) << ", " << rhs(2, 2) << "]]";
+    return out;
+}
+
+constexpr bool operator == (const Matrix3& lhs, const Matrix3& rhs) {
+    for (int i = 0; i < 9; i++) {
+        if (lhs.m[i] != rhs.m[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+constexpr bool operator != (const Matrix3& lhs, const Matrix3& rhs) {return !(lhs == rhs);}
+
+constexpr Matrix3 operator*(Matrix3 const& lhs, Matrix3 const& rhs) {
+    Matrix3 result{};
+    for (int row = 0; row < 3; row++) {
+        for (int column = 0; column < 3; column++) {
+            result(row, column) = lhs(row, 0) * rhs(0, column) + lhs(row, 1) * rhs(1, column) + lhs(row, 2) * rhs(2, column);
+        }
+    }
+    return result;
+}
+
+// Transforms a Vector3. No checks are needed, so this is just 9 multiplies and 6 adds
+constexpr Vector3 operator*(Matrix3 const& lhs, Vector3 const& rhs) {
+    return Vector3{
+        lhs(0, 0) * rhs.x + lhs(0, 1) * rhs.y + lhs(0, 2) * rhs.z,
+        lhs(1, 0) * rhs.x + lhs(1, 1) * rhs.y + lhs(1, 2) * rhs.z,
+        lhs(2, 0) * rhs.x + lhs(2, 1) * rhs.y + lhs(2, 2) * rhs.z,
+    };
+}
+
+// Returns the transpose of a Matrix3
+constexpr Matrix3 transpose(Matrix3 const& matrix) {
+    return Matrix3{{matrix(0, 0), matrix(1, 0), matrix(2, 0), matrix(0, 1), matrix(1, 1), matrix(2, 1), matrix(0, 2), matrix(1, 2), matrix(2, 2)}};
+}
+
+// Returns the determinant of a Matrix3
+constexpr float determinant(Matrix3 const& matrix) {
+    return matrix(0, 0) * (matrix(1, 1) * matrix(2, 2) - matrix(1, 2) * matrix(2, 1))
+         - matrix(0, 1) * (matrix(1, 0) * matrix(2, 2) - matrix(1, 2) * matrix(2, 0))
+         + matrix(0, 2) * (matrix(1, 0) * matrix(2, 1) - matrix(1, 1) * matrix(2, 0));
+}
+
+// A 4x4 floating-point matrix for affine (and projective) 3D transforms, stored contiguously in row-major order like Matrix3
+// Element (row, column) is m[row * 4 + column]. Translation lives in the last column
+struct Matrix4 {
+    float m[16];
+
+    constexpr float operator()(int row, int column) const {return m[row * 4 + column];}
+    constexpr float& operator()(int row, int column) {return m[row * 4 + column];}
+
+    // Returns the identity matrix
+    static constexpr Matrix4 identity() {
+        return Matrix4{{1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f}};
+    }
+
+    // Returns a matrix applying a Matrix3 (such as a rotation) with no translation
+    static constexpr Matrix4 from_matrix3(Matrix3 const& matrix) {
+        return Matrix4{{matrix(0, 0), matrix(0, 1), matrix(0, 2), 0.0f, matrix(1, 0), matrix(1, 1), matrix(1, 2), 0.0f,
+                        matrix(2, 0), matrix(2, 1), matrix(2, 2), 0.0f, 0.0f, 0.0f, 0.0f, 1.0f}};
+    }
+
+    // Returns a matrix that moves points by offset, and leaves directions unchanged
+    static constexpr Matrix4 translation(Vector3 offset) {
+        return Matrix4{{1.0f, 0.0f, 0.0f, offset.x, 0.0f, 1.0f, 0.0f, offset.y, 0.0f, 0.0f, 1.0f, offset.z, 0.0f, 0.0f, 0.0f, 1.0f}};
+    }
+
+    // Returns a matrix that scales each axis by the matching component of factors
+    static constexpr Matrix4 scaling(Vector3 factors) {
+        return from_matrix3(Matrix3::scaling(factors));
+    }
+
+    // Returns a matrix that rotates counterclockwise (right-handed) by degrees around an axis, see Matrix3::rotation
+    static Matrix4 rotation(Vector3 axis, float degrees) {return from_matrix3(Matrix3::rotation(axis, degrees));}
+    static Matrix4 rotation_x(float degrees) {return from_matrix3(Matrix3::rotation_x(degrees));}
+    static Matrix4 rotation_y(float degrees) {return from_matrix3(Matrix3::rotation_y(degrees));}
+    static Matrix4 rotation_z(float degrees) {return from_matrix3(Matrix3::rotation_z(degrees));}
+};
+
+// Matrix4 streaming/printing, one bracketed row after another
+std::ostream& operator << (std::ostream& out, const Matrix4& rhs) {
+    out << "[";
+    for (int row = 0; row < 4; row++) {
+        out << (row ? ", [" : "[") << rhs(row, 0) << ", " << rhs(row, 1) << ", " << rhs(row, 2) << ", " << rhs(row, 3) << "]";
+    }
+    out << "]";
+    return out;
+}
+
+constexpr bool operator == (const Matrix4& lhs, const Matrix4& rhs) {
+    for (int i = 0; i < 16; i++) {
+        if (lhs.m[i] != rhs.m[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+constexpr bool operator != (const Matrix4& lhs, const Matrix4& rhs) {return !(lhs == rhs);}
+
+constexpr Matrix4 operator*(Matrix4 const& lhs, Matrix4 const& rhs) {
+    Matrix4 result{};
+    for (int row = 0; row < 4; row++) {
+        for (int column = 0; column < 4; column++) {
+            result(row, column) = lhs(row, 0) * rhs(0, column) + lhs(row, 1) * rhs(1, column) + lhs(row, 2) * rhs(2, column) + lhs(row, 3) * rhs(3, column);
+        }
+    }
+    return result;
+}
+
+// Transforms a Vector3 as a point (w = 1), so translation applies. The bottom row is ignored, see transform_point for projective matrices
+constexpr Vector3 operator*(Matrix4 const& lhs, Vector3 const& rhs) {
+    return Vector3{
+        lhs(0, 0) * rhs.x + lhs(0, 1) * rhs.y + lhs(0, 2) * rhs.z + lhs(0, 3),
+        lhs(1, 0) * rhs.x + lhs(1, 1) * rhs.y + lhs(1, 2) * rhs.z + lhs(1, 3),
+        lhs(2, 0) * rhs.x + lhs(2, 1) * rhs.y + lhs(2, 2) * rhs.z + lhs(2, 3),
+    };
+}
+
+// Transforms a Vector3 as a point (w = 1), dividing by the resulting w so that projective matrices work too
+constexpr Vector3 transform_point(Matrix4 const& lhs, Vector3 const& rhs) {
+    float w = lhs(3, 0) * rhs.x + lhs(3, 1) * rhs.y + lhs(3, 2) * rhs.z + lhs(3, 3);
+    Vector3 result = lhs * rhs;
+    return w == 1.0f ? result : Vector3{result.x / w, result.y / w, result.z / w};
+}
+
+// Transforms a Vector3 as a direction (w = 0), so translation doesn't apply
+constexpr Vector3 transform_direction(Matrix4 const& lhs, Vector3 const& rhs) {
+    return Vector3{
+        lhs(0, 0) * rhs.x + lhs(0, 1) * rhs.y + lhs(0, 2) * rhs.z,
+        lhs(1, 0) * rhs.x + lhs(1, 1) * rhs.y + lhs(1, 2) * rhs.z,
+        lhs(2, 0) * rhs.x + lhs(2, 1) * rhs.y + lhs(2, 2) * rhs.z,
+    };
+}
+
+// Returns the transpose of a Matrix4
+constexpr Matrix4 transpose(Matrix4 const& matrix) {
+    Matrix4 result{};
+    for (int row = 0; row < 4; row++) {
+        for (int column = 0; column < 4; column++) {
+            result(column, row) = matrix(row, column);
+        }
+    }
+    return result;
+}
+
+// Returns the determinant of a Matrix4, by cofactor expansion along the first row
+constexpr float determinant(Matrix4 const& matrix) {
+    float result = 0.0f;
+    for (int column = 0; column < 4; column++) {
+        Matrix3 minor{};
+        for (int row = 1; row < 4; row++) {
+            for (int c = 0, minor_column = 0; c < 4; c++) {
+                if (c != column) {
+                    minor(row - 1, minor_column++) = matrix(row, c);
+                }
+            }
+        }
+        result += (column % 2 ? -1.0f : 1.0f) * matrix(0, column) * determinant(minor);
+    }
+    return result;
+}
+
+// Allocator for std::vector that aligns its storage to Alignment bytes, such as to a cache line for SIMD loads
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U>
+    struct rebind {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t count) {
+        // Over-allocates by Alignment, keeping the offset to the original pointer just before the aligned one
+        if (count > (SIZE_MAX - Alignment - sizeof(void*)) / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        void* raw = ::operator new(count * sizeof(T) + Alignment + sizeof(void*));
+        uintptr_t aligned = ((uintptr_t)raw + sizeof(void*) + Alignment - 1) & ~(uintptr_t)(Alignment - 1);
+        ((void**)aligned)[-1] = raw;
+        return (T*)aligned;
+    }
+    void deallocate(T* pointer, size_t) {
+        ::operator delete(((void**)pointer)[-1]);
+    }
+};
+template <typename T, typename U, size_t Alignment>
+bool operator == (const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) {return true;}
+template <typename T, typename U, size_t Alignment>
+bool operator != (const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) {return false;}
+
+// SIMD lanes of floats, so that a batch kernel can be written once (as a generic lambda, see simd_for_each) for every instruction set
+// Each lane type has a width, load/store of that many floats (unaligned), gather of that many floats a stride apart, broadcast of one float, and the arithmetic operators
+// simd_multiply_add(a, b, c) is a * b + c, fused into one instruction (and rounding) when the compiler targets FMA
+// simd_select_negative(x, a, b) picks a in lanes where x has its sign bit set (including -0), and b elsewhere
+// simd_rsqrt_estimate(a) is 1 / sqrt(a) to about 12 bits (exactly, for scalar lanes), see fast_rsqrt for a refined version
+struct SimdLanesScalar {
+    static const size_t width = 1;
+    float v;
+    static SimdLanesScalar load(const float* p) {return {*p};}
+    static SimdLanesScalar broadcast(float f) {return {f};}
+    static SimdLanesScalar gather(const float* p, size_t) {return {*p};}
+    void store(float* p) const {*p = v;}
+};
+inline SimdLanesScalar operator + (SimdLanesScalar a, SimdLanesScalar b) {return {a.v + b.v};}
+inline SimdLanesScalar operator - (SimdLanesScalar a, SimdLanesScalar b) {return {a.v - b.v};}
+inline SimdLanesScalar operator * (SimdLanesScalar a, SimdLanesScalar b) {return {a.v * b.v};}
+inline SimdLanesScalar operator / (SimdLanesScalar a, SimdLanesScalar b) {return {a.v / b.v};}
+inline SimdLanesScalar simd_sqrt(SimdLanesScalar a) {return {std::sqrt(a.v)};}
+inline SimdLanesScalar simd_min(SimdLanesScalar a, SimdLanesScalar b) {return {std::min(a.v, b.v)};}
+inline SimdLanesScalar simd_max(SimdLanesScalar a, SimdLanesScalar b) {return {std::max(a.v, b.v)};}
+inline SimdLanesScalar simd_multiply_add(SimdLanesScalar a, SimdLanesScalar b, SimdLanesScalar c) {return {a.v * b.v + c.v};}
+inline SimdLanesScalar simd_abs(SimdLanesScalar a) {return {std::abs(a.v)};}
+inline SimdLanesScalar simd_select_negative(SimdLanesScalar x, SimdLanesScalar if_negative, SimdLanesScalar otherwise) {
+    // Selected with a mask of the sign bit rather than a branch, as the signs of batch inputs tend to be unpredictable
+    uint32_t sign, a, b;
+    memcpy(&sign, &x.v, sizeof(sign));
+    memcpy(&a, &if_negative.v, sizeof(a));
+    memcpy(&b, &otherwise.v, sizeof(b));
+    uint32_t mask = 0u - (sign >> 31);
+    uint32_t bits = (a & mask) | (b & ~mask);
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return {result};
+}
+inline SimdLanesScalar simd_rsqrt_estimate(SimdLanesScalar a) {return {1.0f / std::sqrt(a.v)};} // Exact, as there is no portable estimate instruction
+
+#ifdef ALEXANDRIA_SSE_AVAILABLE
+struct SimdLanesSSE {
+    static const size_t width = 4;
+    __m128 v;
+    static SimdLanesSSE load(const float* p) {return {_mm_loadu_ps(p)};}
+    static SimdLanesSSE broadcast(float f) {return {_mm_set1_ps(f)};}
+    static SimdLanesSSE gather(const float* p, size_t stride) {return {_mm_set_ps(p[3 * stride], p[2 * stride], p[stride], p[0])};}
+    void store(float* p) const {_mm_storeu_ps(p, v);}
+};
+inline SimdLanesSSE operator + (SimdLanesSSE a, SimdLanesSSE b) {return {_mm_add_ps(a.v, b.v)};}
+inline SimdLanesSSE operator - (SimdLanesSSE a, SimdLanesSSE b) {return {_mm_sub_ps(a.v, b.v)};}
+inline SimdLanesSSE operator * (SimdLanesSSE a, SimdLanesSSE b) {return {_mm_mul_ps(a.v, b.v)};}
+inline SimdLanesSSE operator / (SimdLanesSSE a, SimdLanesSSE b) {return {_mm_div_ps(a.v, b.v)};}
+inline SimdLanesSSE simd_sqrt(SimdLanesSSE a) {return {_mm_sqrt_ps(a.v)};}
+inline SimdLanesSSE simd_min(SimdLanesSSE a, SimdLanesSSE b) {return {_mm_min_ps(a.v, b.v)};}
+inline SimdLanesSSE simd_max(SimdLanesSSE a, SimdLanesSSE b) {return {_mm_max_ps(a.v, b.v)};}
+inline SimdLanesSSE simd_abs(SimdLanesSSE a) {return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)};}
+inline SimdLanesSSE simd_select_negative(SimdLanesSSE x, SimdLanesSSE if_negative, SimdLanesSSE otherwise) {
+    __m128 mask = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(x.v), 31));
+    return {_mm_or_ps(_mm_and_ps(mask, if_negative.v), _mm_andnot_ps(mask, otherwise.v))};
+}
+inline SimdLanesSSE simd_rsqrt_estimate(SimdLanesSSE a) {return {_mm_rsqrt_ps(a.v)};}
+#if defined(ALEXANDRIA_AVX_AVAILABLE) && defined(__FMA__)
+inline SimdLanesSSE simd_multiply_add(SimdLanesSSE a, SimdLanesSSE b, SimdLanesSSE c) {return {_mm_fmadd_ps(a.v, b.v, c.v)};}
+#else
+inline SimdLanesSSE simd_multiply_add(SimdLanesSSE a, SimdLanesSSE b, SimdLanesSSE c) {return {_mm_add_ps(_mm_mul_ps(a.v, b.v), c.v)};}
+#endif
+#endif
+
+#ifdef ALEXANDRIA_AVX_AVAILABLE
+struct SimdLanesAVX {
+    static const size_t width = 8;
+    __m256 v;
+    static SimdLanesAVX load(const float* p) {return {_mm256_loadu_ps(p)};}
+    static SimdLanesAVX broadcast(float f) {return {_mm256_set1_ps(f)};}
+    static SimdLanesAVX gather(const float* p, size_t stride) {
+        return {_mm256_set_ps(p[7 * stride], p[6 * stride], p[5 * stride], p[4 * stride], p[3 * stride], p[2 * stride], p[stride], p[0])};
+    }
+    void store(float* p) const {_mm256_storeu_ps(p, v);}
+};
+inline SimdLanesAVX operator + (SimdLanesAVX a, SimdLanesAVX b) {return {_mm256_add_ps(a.v, b.v)};}
+inline SimdLanesAVX operator - (SimdLanesAVX a, SimdLanesAVX b) {return {_mm256_sub_ps(a.v, b.v)};}
+inline SimdLanesAVX operator * (SimdLanesAVX a, SimdLanesAVX b) {return {_mm256_mul_ps(a.v, b.v)};}
+inline SimdLanesAVX operator / (SimdLanesAVX a, SimdLanesAVX b) {return {_mm256_div_ps(a.v, b.v)};}
+inline SimdLanesAVX simd_sqrt(SimdLanesAVX a) {return {_mm256_sqrt_ps(a.v)};}
+inline SimdLanesAVX simd_min(SimdLanesAVX a, SimdLanesAVX b) {return {_mm256_min_ps(a.v, b.v)};}
+inline SimdLanesAVX simd_max(SimdLanesAVX a, SimdLanesAVX b) {return {_mm256_max_ps(a.v, b.v)};}
+inline SimdLanesAVX simd_abs(SimdLanesAVX a) {return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)};}
+inline SimdLanesAVX simd_select_negative(SimdLanesAVX x, SimdLanesAVX if_negative, SimdLanesAVX otherwise) {return {_mm256_blendv_ps(otherwise.v, if_negative.v, x.v)};}
+inline SimdLanesAVX simd_rsqrt_estimate(SimdLanesAVX a) {return {_mm256_rsqrt_ps(a.v)};}
+#ifdef __FMA__
+inline SimdLanesAVX simd_multiply_add(SimdLanesAVX a, SimdLanesAVX b, SimdLanesAVX c) {return {_mm256_fmadd_ps(a.v, b.v, c.v)};}
+#else
+inline SimdLanesAVX simd_multiply_add(SimdLanesAVX a, SimdLanesAVX b, SimdLanesAVX c) {return {_mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v)};}
+#endif
+#endif
+
+// The widest lanes the compiler targets
+#if defined(ALEXANDRIA_AVX_AVAILABLE)
+typedef SimdLanesAVX SimdLanes;
+#elif defined(ALEXANDRIA_SSE_AVAILABLE)
+typedef SimdLanesSSE SimdLanes;
+#else
+typedef SimdLanesScalar SimdLanes;
+#endif
+
+// Runs kernel(lanes, i) over [0, count): with the widest lanes for as long as they fit, then with scalar lanes for the remainder
+// The kernel is usually a generic lambda, using decltype(lanes) to load, store, and broadcast
+template <typename F>
+inline void simd_for_each(size_t count, F kernel) {
+    size_t i = 0;
+    for (; i + SimdLanes::width <= count; i += SimdLanes::width) {
+        kernel(SimdLanes(), i);
+    }
+    for (; i < count; i++) {
+        kernel(SimdLanesScalar(), i);
+    }
+}
+
+// Base of every lazily evaluated Vector3 array expression, see the expression templates below Vector3Array
+// Each expression E has size() and lanes<L>(component, i), which computes component 0, 1, or 2 (x, y, or z) of elements [i, i + L::width)
+template <typename E>
+struct Vector3Expression {
+    const E& self() const {return static_cast<const E&>(*this);}
+};
+
+// An array of Vector3 stored as a structure of arrays (all x, then all y, then all z), so that batch functions process several vectors per instruction
+// Convert to and from std::vector<Vector3> with the constructor and to_vector(). The batch functions below write to an output argument, which
+//  is resized to fit and may be one of the inputs, and throw std::invalid_argument if two input arrays differ in size
+// Arithmetic operators build lazily evaluated expressions, which are computed in a single pass when assigned to a Vector3Array
+struct Vector3Array : Vector3Expression<Vector3Array> {
+    std::vector<float, AlignedAllocator<float>> x;
+    std::vector<float, AlignedAllocator<float>> y;
+    std::vector<float, AlignedAllocator<float>> z;
+
+    Vector3Array() {}
+    explicit Vector3Array(size_t count) : x(count), y(count), z(count) {}
+    Vector3Array(const std::vector<Vector3>& vectors) : x(vectors.size()), y(vectors.size()), z(vectors.size()) {
+        for (size_t i = 0; i < vectors.size(); i++) {
+            x[i] = vectors[i].x;
+            y[i] = vectors[i].y;
+            z[i] = vectors[i].z;
+        }
+    }
+
+    // Returns the vectors as a std::vector<Vector3>
+    std::vector<Vector3> to_vector() const {
+        std::vector<Vector3> vectors(size());
+        for (size_t i = 0; i < vectors.size(); i++) {
+            vectors[i] = {x[i], y[i], z[i]};
+        }
+        return vectors;
+    }
+
+    size_t size() const {return x.size();}
+    bool empty() const {return x.empty();}
+    void resize(size_t count) {
+        x.resize(count);
+        y.resize(count);
+        z.resize(count);
+    }
+    void reserve(size_t count) {
+        x.reserve(count);
+        y.reserve(count);
+        z.reserve(count);
+    }
+    void push_back(const Vector3& v) {
+        x.push_back(v.x);
+        y.push_back(v.y);
+        z.push_back(v.z);
+    }
+    Vector3 operator[](size_t i) const {return {x[i], y[i], z[i]};}
+    void set(size_t i, const Vector3& v) {
+        x[i] = v.x;
+        y[i] = v.y;
+        z[i] = v.z;
+    }
+
+    // Evaluates an expression, such as a + b * s - c, in a single pass. See evaluate()
+    template <typename E>
+    Vector3Array(const Vector3Expression<E>& expression) {
+        evaluate(expression, *this);
+    }
+    template <typename E>
+    Vector3Array& operator = (const Vector3Expression<E>& expression) {
+        evaluate(expression, *this);
+        return *this;
+    }
+    template <typename E>
+    Vector3Array& operator += (const Vector3Expression<E>& expression) {
+        evaluate(*this + expression, *this);
+        return *this;
+    }
+    template <typename E>
+    Vector3Array& operator -= (const Vector3Expression<E>& expression) {
+        evaluate(*this - expression, *this);
+        return *this;
+    }
+
+    // Loads component 0, 1, or 2 (x, y, or z) of elements [i, i + L::width), as an expression
+    template <typename L>
+    L lanes(int component, size_t i) const {
+        return L::load(component == 0 ? &x[i] : component == 1 ? &y[i] : &z[i]);
+    }
+};
+
+// Vector3Array streaming/printing, as a list of vectors
+std::ostream& operator << (std::ostream& out, const Vector3Array& rhs) {
+    out << "[";
+    for (size_t i = 0; i < rhs.size(); i++) {
+        out << (i ? ", " : "") << rhs[i];
+    }
+    out << "]";
+    return out;
+}
+
+// Throws if two Vector3Arrays given to a batch function differ in size
+void vector3_array_check_sizes(const Vector3Array& lhs, const Vector3Array& rhs) {
+    if (lhs.size() != rhs.size()) {
+        throw std::invalid_argument("Vector3Array batch functions are only defined for arrays of the same size.");
+    }
+}
+
+// Stores lhs[i] + rhs[i] into out[i]
+void add(const Vector3Array& lhs, const Vector3Array& rhs, Vector3Array& out) {
+    vector3_array_check_sizes(lhs, rhs);
+    out.resize(lhs.size());
+    simd_for_each(lhs.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        (L::load(&lhs.x[i]) + L::load(&rhs.x[i])).store(&out.x[i]);
+        (L::load(&lhs.y[i]) + L::load(&rhs.y[i])).store(&out.y[i]);
+        (L::load(&lhs.z[i]) + L::load(&rhs.z[i])).store(&out.z[i]);
+    });
+}
+
+// Stores lhs[i] - rhs[i] into out[i]
+void subtract(const Vector3Array& lhs, const Vector3Array& rhs, Vector3Array& out) {
+    vector3_array_check_sizes(lhs, rhs);
+    out.resize(lhs.size());
+    simd_for_each(lhs.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        (L::load(&lhs.x[i]) - L::load(&rhs.x[i])).store(&out.x[i]);
+        (L::load(&lhs.y[i]) - L::load(&rhs.y[i])).store(&out.y[i]);
+        (L::load(&lhs.z[i]) - L::load(&rhs.z[i])).store(&out.z[i]);
+    });
+}
+
+// Stores v[i] * scalar into out[i]
+void scale(const Vector3Array& v, float scalar, Vector3Array& out) {
+    out.resize(v.size());
+    simd_for_each(v.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        L s = L::broadcast(scalar);
+        (L::load(&v.x[i]) * s).store(&out.x[i]);
+        (L::load(&v.y[i]) * s).store(&out.y[i]);
+        (L::load(&v.z[i]) * s).store(&out.z[i]);
+    });
+}
+
+// Stores dot(lhs[i], rhs[i]) into out[i]
+void dot(const Vector3Array& lhs, const Vector3Array& rhs, std::vector<float>& out) {
+    vector3_array_check_sizes(lhs, rhs);
+    out.resize(lhs.size());
+    simd_for_each(lhs.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        (L::load(&lhs.x[i]) * L::load(&rhs.x[i]) + L::load(&lhs.y[i]) * L::load(&rhs.y[i]) + L::load(&lhs.z[i]) * L::load(&rhs.z[i])).store(&out[i]);
+    });
+}
+
+// Stores cross(lhs[i], rhs[i]) into out[i]
+void cross(const Vector3Array& lhs, const Vector3Array& rhs, Vector3Array& out) {
+    vector3_array_check_sizes(lhs, rhs);
+    out.resize(lhs.size());
+    simd_for_each(lhs.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        L ax = L::load(&lhs.x[i]), ay = L::load(&lhs.y[i]), az = L::load(&lhs.z[i]);
+        L bx = L::load(&rhs.x[i]), by = L::load(&rhs.y[i]), bz = L::load(&rhs.z[i]);
+        // Every input is loaded before storing, so out may alias either input
+        (ay * bz - az * by).store(&out.x[i]);
+        (az * bx - ax * bz).store(&out.y[i]);
+        (ax * by - ay * bx).store(&out.z[i]);
+    });
+}
+
+// Stores magnitude(v[i]) into out[i]
+void magnitude(const Vector3Array& v, std::vector<float>& out) {
+    out.resize(v.size());
+    simd_for_each(v.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        L x = L::load(&v.x[i]), y = L::load(&v.y[i]), z = L::load(&v.z[i]);
+        simd_sqrt(x * x + y * y + z * z).store(&out[i]);
+    });
+}
+
+// Stores normalize(v[i]) into out[i]
+void normalize(const Vector3Array& v, Vector3Array& out) {
+    out.resize(v.size());
+    simd_for_each(v.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        L x = L::load(&v.x[i]), y = L::load(&v.y[i]), z = L::load(&v.z[i]);
+        L inverse = L::broadcast(1.0f) / simd_sqrt(x * x + y * y + z * z);
+        (x * inverse).store(&out.x[i]);
+        (y * inverse).store(&out.y[i]);
+        (z * inverse).store(&out.z[i]);
+    });
+}
+
+// Stores angle(lhs[i], rhs[i]) into out[i], in degrees
+// The cosine is computed in SIMD lanes and clamped to [-1, 1] (so near-parallel vectors give 0 rather than NaN), and then std::acos is applied per vector
+void angle(const Vector3Array& lhs, const Vector3Array& rhs, std::vector<float>& out) {
+    vector3_array_check_sizes(lhs, rhs);
+    out.resize(lhs.size());
+    simd_for_each(lhs.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        L ax = L::load(&lhs.x[i]), ay = L::load(&lhs.y[i]), az = L::load(&lhs.z[i]);
+        L bx = L::load(&rhs.x[i]), by = L::load(&rhs.y[i]), bz = L::load(&rhs.z[i]);
+        L cosine = (ax * bx + ay * by + az * bz) / simd_sqrt((ax * ax + ay * ay + az * az) * (bx * bx + by * by + bz * bz));
+        simd_max(simd_min(cosine, L::broadcast(1.0f)), L::broadcast(-1.0f)).store(&out[i]);
+    });
+    for (float& a : out) {
+        a = static_cast<float>(std::acos(a) * 180.0f / M_PI);
+    }
+}
+
+// Stores angle(lhs[i], rhs) into out[i], in degrees, such as the angle of every vector from one direction
+void angle(const Vector3Array& lhs, Vector3 const& rhs, std::vector<float>& out) {
+    out.resize(lhs.size());
+    simd_for_each(lhs.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        L ax = L::load(&lhs.x[i]), ay = L::load(&lhs.y[i]), az = L::load(&lhs.z[i]);
+        L cosine = (ax * L::broadcast(rhs.x) + ay * L::broadcast(rhs.y) + az * L::broadcast(rhs.z)) / simd_sqrt((ax * ax + ay * ay + az * az) * L::broadcast(length_squared(rhs)));
+        simd_max(simd_min(cosine, L::broadcast(1.0f)), L::broadcast(-1.0f)).store(&out[i]);
+    });
+    for (float& a : out) {
+        a = static_cast<float>(std::acos(a) * 180.0f / M_PI);
+    }
+}
+
+// Returning versions of the batch functions, for when the output isn't being reused
+Vector3Array add(const Vector3Array& lhs, const Vector3Array& rhs) {Vector3Array out; add(lhs, rhs, out); return out;}
+Vector3Array subtract(const Vector3Array& lhs, const Vector3Array& rhs) {Vector3Array out; subtract(lhs, rhs, out); return out;}
+Vector3Array scale(const Vector3Array& v, float scalar) {Vector3Array out; scale(v, scalar, out); return out;}
+std::vector<float> dot(const Vector3Array& lhs, const Vector3Array& rhs) {std::vector<float> out; dot(lhs, rhs, out); return out;}
+Vector3Array cross(const Vector3Array& lhs, const Vector3Array& rhs) {Vector3Array out; cross(lhs, rhs, out); return out;}
+std::vector<float> magnitude(const Vector3Array& v) {std::vector<float> out; magnitude(v, out); return out;}
+Vector3Array normalize(const Vector3Array& v) {Vector3Array out; normalize(v, out); return out;}
+std::vector<float> angle(const Vector3Array& lhs, const Vector3Array& rhs) {std::vector<float> out; angle(lhs, rhs, out); return out;}
+std::vector<float> angle(const Vector3Array& lhs, Vector3 const& rhs) {std::vector<float> out; angle(lhs, rhs, out); return out;}
+
+// Vector3 array expression templates
+// Operators on Vector3Arrays (and on std::vector<Vector3> through lazy()) build a tree of the nodes below instead of computing anything, and
+//  assigning that tree to a Vector3Array or evaluate()ing it into a std::vector<Vector3> runs the whole expression in one loop, with a single
+//  store per element, instead of one pass over memory (and one temporary array) per operator
+// Nodes refer to the arrays they were built from, so an expression should be evaluated in the statement that builds it rather than kept with auto
+
+// How an expression node holds an operand: arrays by reference, and other (small) nodes by value, as they are usually temporaries
+template <typename E>
+struct Vector3ExpressionOperand {
+    typedef E type;
+};
+template <>
+struct Vector3ExpressionOperand<Vector3Array> {
+    typedef const Vector3Array& type;
+};
+
+// The element-wise operations that expression nodes apply
+struct Vector3ExpressionAdd {
+    template <typename L> static L apply(L lhs, L rhs) {return lhs + rhs;}
+};
+struct Vector3ExpressionSubtract {
+    template <typename L> static L apply(L lhs, L rhs) {return lhs - rhs;}
+};
+struct Vector3ExpressionMultiply {
+    template <typename L> static L apply(L lhs, L rhs) {return lhs * rhs;}
+};
+struct Vector3ExpressionDivide {
+    template <typename L> static L apply(L lhs, L rhs) {return lhs / rhs;}
+};
+
+// A std::vector<Vector3> as an expression, see lazy()
+struct Vector3View : Vector3Expression<Vector3View> {
+    const Vector3* data;
+    size_t count;
+
+    Vector3View(const Vector3* data, size_t count) : data(data), count(count) {}
+
+    size_t size() const {return count;}
+
+    // Gathers one component of several interleaved vectors, reading them as packed floats
+    template <typename L>
+    L lanes(int component, size_t i) const {
+        static_assert(sizeof(Vector3) == 3 * sizeof(float), "Vector3View reads Vector3 arrays as packed floats");
+        return L::gather(&data[i].x + component, 3);
+    }
+};
+
+// Returns a std::vector<Vector3> as an expression, so that it can be used with the Vector3Array operators, such as lazy(a) + lazy(b) * s
+Vector3View lazy(const std::vector<Vector3>& vectors) {
+    return Vector3View(vectors.data(), vectors.size());
+}
+Vector3View lazy(std::vector<Vector3>&& vectors) = delete; // The view would outlive a temporary
+
+// lhs[i] op rhs[i], for two expressions of the same size
+template <typename Op, typename A, typename B>
+struct Vector3ExpressionBinary : Vector3Expression<Vector3ExpressionBinary<Op, A, B>> {
+    typename Vector3ExpressionOperand<A>::type lhs;
+    typename Vector3ExpressionOperand<B>::type rhs;
+
+    Vector3ExpressionBinary(const A& lhs, const B& rhs) : lhs(lhs), rhs(rhs) {
+        if (lhs.size() != rhs.size()) {
+            throw std::invalid_argument("Vector3 array expressions are only defined for arrays of the same size.");
+        }
+    }
+
+    size_t size() const {return lhs.size();}
+
+    template <typename L>
+    L lanes(int component, size_t i) const {
+        return Op::apply(lhs.template lanes<L>(component, i), rhs.template lanes<L>(component, i));
+    }
+};
+
+// array[i] op uniform, or uniform op array[i] if Reversed, where uniform is a float or a Vector3 used for every element
+template <typename Op, typename A, typename U, bool Reversed>
+struct Vector3ExpressionUniform : Vector3Expression<Vector3ExpressionUniform<Op, A, U, Reversed>> {
+    typename Vector3ExpressionOperand<A>::type array;
+    U uniform;
+
+    Vector3ExpressionUniform(const A& array, U uniform) : array(array), uniform(uniform) {}
+
+    size_t size() const {return array.size();}
+
+    template <typename L>
+    L lanes(int component, size_t i) const {
+        L u = L::broadcast(uniform_component(uniform, component));
+        L a = array.template lanes<L>(component, i);
+        return Reversed ? Op::apply(u, a) : Op::apply(a, u);
+    }
+
+private:
+    static float uniform_component(float f, int) {return f;}
+    static float uniform_component(const Vector3& v, int component) {return component == 0 ? v.x : component == 1 ? v.y : v.z;}
+};
+
+// Arithmetic operators on expressions (including Vector3Array), each returning a new, unevaluated expression
+template <typename A, typename B>
+Vector3ExpressionBinary<Vector3ExpressionAdd, A, B> operator + (const Vector3Expression<A>& lhs, const Vector3Expression<B>& rhs) {return {lhs.self(), rhs.self()};}
+template <typename A, typename B>
+Vector3ExpressionBinary<Vector3ExpressionSubtract, A, B> operator - (const Vector3Expression<A>& lhs, const Vector3Expression<B>& rhs) {return {lhs.self(), rhs.self()};}
+template <typename A>
+Vector3ExpressionUniform<Vector3ExpressionAdd, A, Vector3, false> operator + (const Vector3Expression<A>& lhs, const Vector3& rhs) {return {lhs.self(), rhs};}
+template <typename A>
+Vector3ExpressionUniform<Vector3ExpressionAdd, A, Vector3, true> operator + (const Vector3& lhs, const Vector3Expression<A>& rhs) {return {rhs.self(), lhs};}
+template <typename A>
+Vector3ExpressionUniform<Vector3ExpressionSubtract, A, Vector3, false> operator - (const Vector3Expression<A>& lhs, const Vector3& rhs) {return {lhs.self(), rhs};}
+template <typename A>
+Vector3ExpressionUniform<Vector3ExpressionSubtract, A, Vector3, true> operator - (const Vector3& lhs, const Vector3Expression<A>& rhs) {return {rhs.self(), lhs};}
+template <typename A>
+Vector3ExpressionUniform<Vector3ExpressionMultiply, A, float, false> operator * (const Vector3Expression<A>& lhs, float rhs) {return {lhs.self(), rhs};}
+template <typename A>
+Vector3ExpressionUniform<Vector3ExpressionMultiply, A, float, true> operator * (float lhs, const Vector3Expression<A>& rhs) {return {rhs.self(), lhs};}
+template <typename A>
+Vector3ExpressionUniform<Vector3ExpressionDivide, A, float, false> operator / (const Vector3Expression<A>& lhs, float rhs) {return {lhs.self(), rhs};}
+template <typename A>
+Vector3ExpressionUniform<Vector3ExpressionMultiply, A, float, false> operator - (const Vector3Expression<A>& rhs) {return {rhs.self(), -1.0f};}
+
+// Computes an expression into out in a single pass, resizing it to fit. out may appear in the expression
+template <typename E>
+void evaluate(const Vector3Expression<E>& expression, Vector3Array& out) {
+    const E& e = expression.self();
+    out.resize(e.size());
+    simd_for_each(e.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        // Every component is computed before any is stored, so that elements are read before they're overwritten
+        L x = e.template lanes<L>(0, i), y = e.template lanes<L>(1, i), z = e.template lanes<L>(2, i);
+        x.store(&out.x[i]);
+        y.store(&out.y[i]);
+        z.store(&out.z[i]);
+    });
+}
+// Interleaved output is written one vector at a time, which the compiler vectorizes better than transposing SIMD lanes through memory
+template <typename E>
+void evaluate(const Vector3Expression<E>& expression, std::vector<Vector3>& out) {
+    const E& e = expression.self();
+    out.resize(e.size());
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i] = {e.template lanes<SimdLanesScalar>(0, i).v, e.template lanes<SimdLanesScalar>(1, i).v, e.template lanes<SimdLanesScalar>(2, i).v};
+    }
+}
+
+// Returning versions of evaluate
+template <typename E>
+std::vector<Vector3> evaluate(const Vector3Expression<E>& expression) {std::vector<Vector3> out; evaluate(expression, out); return out;}
+
+// Fast approximate math, for when a few significant digits are enough (such as lighting and steering)
+// Maximum errors were measured over every float input (fast_rsqrt) or tens of millions of random inputs (the rest):
+//  fast_rsqrt and fast_normalize: 3e-7 relative error with SSE/AVX. Without SSE they are exact, as are the ends of batches. fast_magnitude is always exact
+//  fast_acos: 6.8e-5 radians, so fast_angle is within 0.004 degrees (more near 0 and 180 degrees, where acos magnifies errors in the cosine)
+//  fast_atan2: 1.2e-5 radians
+
+// Refines lanes of 1 / sqrt(a) estimates with one Newton-Raphson step, about doubling their correct bits
+template <typename L>
+inline L simd_rsqrt(L a) {
+    L estimate = simd_rsqrt_estimate(a);
+    return estimate * (L::broadcast(1.5f) - L::broadcast(0.5f) * a * estimate * estimate);
+}
+
+// Approximates acos(x) for lanes of x in [-1, 1], using the polynomial of Abramowitz and Stegun 4.4.45 on |x| and reflecting negatives
+template <typename L>
+inline L simd_acos(L x) {
+    L a = simd_abs(x);
+    L polynomial = simd_multiply_add(simd_multiply_add(simd_multiply_add(L::broadcast(-0.0187293f), a, L::broadcast(0.0742610f)), a, L::broadcast(-0.2121144f)), a, L::broadcast(1.5707288f));
+    L result = simd_sqrt(L::broadcast(1.0f) - a) * polynomial;
+    return simd_select_negative(x, L::broadcast((float)M_PI) - result, result);
+}
+
+// Approximates atan2(y, x) for lanes, in radians, using the polynomial of Abramowitz and Stegun 4.4.47 for atan on [0, 1] and folding the octants around it
+template <typename L>
+inline L simd_atan2(L y, L x) {
+    L ax = simd_abs(x);
+    L ay = simd_abs(y);
+    // The max is kept above 0 so that atan2(0, 0) gives 0, like std::atan2, rather than NaN
+    L a = simd_min(ax, ay) / simd_max(simd_max(ax, ay), L::broadcast(1e-30f));
+    L s = a * a;
+    L polynomial = simd_multiply_add(simd_multiply_add(simd_multiply_add(simd_multiply_add(L::broadcast(0.0208351f), s, L::broadcast(-0.0851330f)), s, L::broadcast(0.1801410f)), s, L::broadcast(-0.3302995f)), s, L::broadcast(0.9998660f));
+    L result = a * polynomial;
+    result = simd_select_negative(ax - ay, L::broadcast((float)(M_PI / 2.0)) - result, result);
+    result = simd_select_negative(x, L::broadcast((float)M_PI) - result, result);
+    return simd_select_negative(y, L::broadcast(0.0f) - result, result);
+}
+
+// Returns 1 / sqrt(x) to about 22 bits, using the SSE estimate instruction and a Newton-Raphson step (or exactly, without SSE)
+inline float fast_rsqrt(float x) {
+#ifdef ALEXANDRIA_SSE_AVAILABLE
+    return _mm_cvtss_f32(simd_rsqrt(SimdLanesSSE{_mm_set_ss(x)}).v);
+#else
+    return simd_rsqrt(SimdLanesScalar{x}).v;
+#endif
+}
+
+// Returns an approximate acos(x) in radians, for x in [-1, 1]
+inline float fast_acos(float x) {
+    return simd_acos(SimdLanesScalar{x}).v;
+}
 
---- Recently Completed And Undocumented ---
+// Returns an approximate atan2(y, x) in radians
+inline float fast_atan2(float y, float x) {
+    return simd_atan2(SimdLanesScalar{y}, SimdLanesScalar{x}).v;
+}
 
---- NOW ---
-plasmamap like heatmap, or perhaps have support for custom colors in heatmap and default predefinitions for color ranges
-Add line number support to save_pdf
+// Returns the magnitude of a Vector3. This is exact: one hardware square root is already faster than refining an estimate and multiplying,
+//  so it is only here so that code can switch to the fast_ functions wholesale
+inline float fast_magnitude(Vector3 v) {
+    return magnitude(v);
+}
 
---- Future Work ---
-Add step support for PythonicVector slicing
-A function to fetch data from a URL and return it as a string
-A reshape function for 2D/3D arrays (array -> 1D list)
-DEBUG-define-only log to file
-A rate-based main loop and callback strucure that can activate functions based on a rate in Hz
-Multidimensional vector extraction (copy work from HCR class)
-Simple code documentation maker (in markdown)
-Function to get a vector list in strings of all filepaths in a directory, even recursively
-A wrapper for fprintf(stdout, string, ...) just as "print()"
-A function to turn integers of a count of bytes into software/hardware KB/MB/GB summary strings
-Generalized structure message construction for serialization, network communication, events, pub/sub models, etc.
-ROS-like event-driven topic publisher and subscriber model
-A point struct and a system to iterate over certain coordinates, such as all in a circle or within a letter or the like
-a define-based system that can remove large sections of code for different debug/release compilations, such as unit tests, print statements, and anything else
-to-stream functions for all classes
-ultra-basic 2D/3D physics engine wrapper using Verlet Integration: https://www.youtube.com/watch?v=lS_qeBy3aQI
-    and friction: https://stackoverflow.com/questions/10270875/verlet-integrator-friction
-This color lookup map function: https://www.youtube.com/watch?v=HsOKwUwL1bE
-SDICL support and fast kernel interfacing
-Make the extract functions templated like the string format function
-Regular expression expansion / mapping with returned variable environment map
-Fast calculation and return of a set of points in a circle around another point (from SDL_wrapper)
-Angle calculation between three points, with one as center. Multidimensional it.
-Plotting functionality, even if basic. Save to BMP or image vector for users to display themselves.
-Serialization and un-serialization of N-dimensional vectors of basic types
-N-dimensional index to 1-dimensional index collapse
-Reading from bitmap files, even if only ones written by this file
-General-purpose raycasting structure and library, implemented to be as fast as possible
-    https://github.com/ssloy/tinyraycaster/wiki
-BigInt, like https://stackoverflow.com/questions/4507121/c-big-integer
----
-Benched:
-Add a debug macro that just returns that string instead of printing it (requires different overloads, so tabled for now)
-Numpy-like zeros and ones functions for making vectors automatically of different shapes and sizes (return types are nightmarish)
-*/
+// Returns an approximately normalized Vector3
+inline Vector3 fast_normalize(Vector3 v) {
+    return v * fast_rsqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+}
 
-////////// SETUP //////////
+// Returns the approximate angle between two Vector3, in degrees
+inline float fast_angle(Vector3 const& lhs, Vector3 const& rhs) {
+    float cosine = dot(lhs, rhs) * fast_rsqrt(dot(lhs, lhs)) * fast_rsqrt(dot(rhs, rhs));
+    return fast_acos(std::max(std::min(cosine, 1.0f), -1.0f)) * (float)(180.0 / M_PI);
+}
 
-#define PI 3.14159265358979
+// Stores fast_magnitude(v[i]) into out[i], which is exactly magnitude(v[i]) for the same reason
+void fast_magnitude(const Vector3Array& v, std::vector<float>& out) {
+    magnitude(v, out);
+}
 
-#define _USE_MATH_DEFINES
-#include <cmath> // Math functions, used throughout
-#include <string> // C++ string library, used throughout
-#include <vector> // C++ vector library, used throughout
-#include <map> // C++ map library, used throughout
-#include <random> // Random number generation, used only for "random" functions
-#include <iostream> // C++ stream input/output, used throughout
-#include <fstream> // C++ finestreaming, used for saving/loading functions
-#include <functional> // C++ functions-as-variables, used for some classes
-#include <stdexcept> // Clean and pretty exception throwing
-#include <iomanip> // std::setprecision
-#include <stdlib.h> // Pathnames and other utilities
-#include <chrono> // Time-based functions
-#include <algorithm> // Because having a "reverse" function is handy
+// Stores fast_normalize(v[i]) into out[i]
+void fast_normalize(const Vector3Array& v, Vector3Array& out) {
+    out.resize(v.size());
+    simd_for_each(v.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        L x = L::load(&v.x[i]), y = L::load(&v.y[i]), z = L::load(&v.z[i]);
+        L inverse = simd_rsqrt(x * x + y * y + z * z);
+        (x * inverse).store(&out.x[i]);
+        (y * inverse).store(&out.y[i]);
+        (z * inverse).store(&out.z[i]);
+    });
+}
 
+// Stores fast_angle(lhs[i], rhs[i]) into out[i], in degrees, entirely in SIMD lanes
+void fast_angle(const Vector3Array& lhs, const Vector3Array& rhs, std::vector<float>& out) {
+    vector3_array_check_sizes(lhs, rhs);
+    out.resize(lhs.size());
+    simd_for_each(lhs.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        L ax = L::load(&lhs.x[i]), ay = L::load(&lhs.y[i]), az = L::load(&lhs.z[i]);
+        L bx = L::load(&rhs.x[i]), by = L::load(&rhs.y[i]), bz = L::load(&rhs.z[i]);
+        L cosine = (ax * bx + ay * by + az * bz) * simd_rsqrt(ax * ax + ay * ay + az * az) * simd_rsqrt(bx * bx + by * by + bz * bz);
+        cosine = simd_max(simd_min(cosine, L::broadcast(1.0f)), L::broadcast(-1.0f));
+        (simd_acos(cosine) * L::broadcast((float)(180.0 / M_PI))).store(&out[i]);
+    });
+}
 
-////////// MACROS //////////
-#ifndef USE_ALEXANDRIA_COLORLESS
-// Terminal colors (source: https://www.lihaoyi.com/post/BuildyourownCommandLinewithANSIescapecodes.html)
-#define T_RESET "\e[0m"
-// Terminal Foreground Colors
-#define T_BLACK "\e[30m"
-#define T_RED "\e[31m"
-#define T_GREEN "\e[32m" // equivalently "\e[0;32m"
-#define T_YELLOW "\e[33m"
-#define T_BLUE "\e[34m"
-#define T_MAGENTA "\e[35m"
-#define T_CYAN "\e[36m"
-#define T_WHITE "\e[37m"
-// Terminal Background Colors
-#define TB_BLACK "\e[40m"
-#define TB_RED "\e[41m"
-#define TB_GREEN "\e[42m"
-#define TB_YELLOW "\e[43m"
-#define TB_BLUE "\e[44m"
-#define TB_MAGENTA "\e[45m"
-#define TB_CYAN "\e[36m"
-#define TB_WHITE "\e[37m"
-#else // Below is placeholder values for colorless compilation
-#define T_RESET ""
-#define T_BLACK ""
-#define T_RED ""
-#define T_GREEN ""
-#define T_YELLOW ""
-#define T_BLUE ""
-#define T_MAGENTA ""
-#define T_CYAN ""
-#define T_WHITE ""
-// Terminal Background Colors
-#define TB_BLACK ""
-#define TB_RED ""
-#define TB_GREEN ""
-#define TB_YELLOW ""
-#define TB_BLUE ""
-#define TB_MAGENTA ""
-#define TB_CYAN ""
-#define TB_WHITE ""
-#endif
+// Stores fast_angle(lhs[i], rhs) into out[i], in degrees, with the length of rhs only estimated once
+void fast_angle(const Vector3Array& lhs, Vector3 const& rhs, std::vector<float>& out) {
+    out.resize(lhs.size());
+    float rhs_inverse = fast_rsqrt(length_squared(rhs));
+    simd_for_each(lhs.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        L ax = L::load(&lhs.x[i]), ay = L::load(&lhs.y[i]), az = L::load(&lhs.z[i]);
+        L cosine = (ax * L::broadcast(rhs.x) + ay * L::broadcast(rhs.y) + az * L::broadcast(rhs.z)) * simd_rsqrt(ax * ax + ay * ay + az * az) * L::broadcast(rhs_inverse);
+        cosine = simd_max(simd_min(cosine, L::broadcast(1.0f)), L::broadcast(-1.0f));
+        (simd_acos(cosine) * L::broadcast((float)(180.0 / M_PI))).store(&out[i]);
+    });
+}
 
-// Debugging macros
-#define INFO(x) std::cout << #x << " @ " << &x <<  " (" << typeid(x).name() << ") = " << x << std::endl;
-#define INFO_NOVALUE(x) std::cout << #x << " @ " << &x << " (" << typeid(x).name() << ")" << std::endl;
-#define INFO_BASIC(x) std::cout << #x << " (" << typeid(x).name() << ")" << std::endl;
-#define LOCATION (std::string)__FILE__ + ":" + std::to_string(__LINE__) + ":" + (std::string)__func__
-#define COMPILE_TIME (std::string)(__TIME__) + " on " + (std::string)(__DATE__)
+// Stores fast_atan2(y[i], x[i]) into out[i], in radians, throwing std::invalid_argument if y and x differ in size
+void fast_atan2(const std::vector<float>& y, const std::vector<float>& x, std::vector<float>& out) {
+    if (y.size() != x.size()) {
+        throw std::invalid_argument("fast_atan2 batches are only defined for arrays of the same size.");
+    }
+    out.resize(y.size());
+    simd_for_each(y.size(), [&](auto lanes, size_t i) {
+        typedef decltype(lanes) L;
+        simd_atan2(L::load(&y[i]), L::load(&x[i])).store(&out[i]);
+    });
+}
 
-// Debug printing macros
-#define PRINT_VECTOR(x) std::cout << #x << " = "; for (auto i : x) { std::cout << i << " "; } std::cout << std::endl;
+// Returning versions of the fast batch functions, for when the output isn't being reused
+std::vector<float> fast_magnitude(const Vector3Array& v) {std::vector<float> out; fast_magnitude(v, out); return out;}
+Vector3Array fast_normalize(const Vector3Array& v) {Vector3Array out; fast_normalize(v, out); return out;}
+std::vector<float> fast_angle(const Vector3Array& lhs, const Vector3Array& rhs) {std::vector<float> out; fast_angle(lhs, rhs, out); return out;}
+std::vector<float> fast_angle(const Vector3Array& lhs, Vector3 const& rhs) {std::vector<float> out; fast_angle(lhs, rhs, out); return out;}
+std::vector<float> fast_atan2(const std::vector<float>& y, const std::vector<float>& x) {std::vector<float> out; fast_atan2(y, x, out); return out;}
 
-// Debug logging macros, only actually print if DEBUG is defined
-#ifdef DEBUG
-#define LOG(x) std::cout << T_BLUE << "LOG: " << T_RESET << x << std::endl;
-#define PASS(x) std::cout << T_GREEN << "PASS: " << T_RESET << x << std::endl;
-#define WARNING(x) std::cout << T_YELLOW << "WARNING: " << T_RESET << x << std::endl;
-#define ERROR(x) std::cout << T_RED << "ERROR: " << T_RESET << x << std::endl;
-#else
-#define LOG(x)
-#define PASS(x)
-#define WARNING(x)
-#define ERROR(x)
+// Matrix multiplication settings, each of which may be defined before including this file to override it
+#ifndef MATRIX_BLOCK_ROWS
+#define MATRIX_BLOCK_ROWS 144 // Rows of lhs packed together, sized so the packed block (rows * depth floats) stays in L2 cache. Rounded to a multiple of the micro-kernel's 6
+#endif
+#ifndef MATRIX_BLOCK_DEPTH
+#define MATRIX_BLOCK_DEPTH 256 // Inner dimension packed at once, sized so one micro-kernel's slice of rhs stays in L1 cache
+#endif
+#ifndef MATRIX_BLOCK_COLUMNS
+#define MATRIX_BLOCK_COLUMNS 512 // Columns of rhs packed together, sized so the packed panel (depth * columns floats) stays in L2/L3 cache
+#endif
+#ifndef MATRIX_SMALL_THRESHOLD
+#define MATRIX_SMALL_THRESHOLD 32768 // Multiply-adds (rows * inner * columns) at or below which matrix_multiply skips blocking and packing altogether
+#endif
+#ifndef MATRIX_PARALLEL_THRESHOLD
+#define MATRIX_PARALLEL_THRESHOLD 2000000 // Multiply-adds (rows * inner * columns) below which matrix_multiply stays on the calling thread
 #endif
 
-// Testing macros
-unsigned int TESTS_TOTAL = 0;
-unsigned int TESTS_SUCCESSFUL = 0;
-bool TESTS_SILENT = false; // If set true, tests other than summary will have no output
-std::vector<std::string> TESTS_FAILURES;
-#define TEST(x) TESTS_TOTAL++; if (x) {TESTS_SUCCESSFUL++; if (!TESTS_SILENT) {std::cout << T_GREEN << "test passed @ " << LOCATION << T_RESET << std::endl;}} else {TESTS_FAILURES.push_back(LOCATION); if (!TESTS_SILENT) {std::cout << T_RED << "TEST FAILED @ " << LOCATION << T_RESET << std::endl << "\twhere " << #x << " (" << (x) << ") was FALSE" << std::endl;}}
-#define TEST_NAMED(n, x) TESTS_TOTAL++; if (x) {TESTS_SUCCESSFUL++; if (!TESTS_SILENT) {std::cout << T_GREEN << "test \"" << n << "\" passed @ " << LOCATION << T_RESET << std::endl;}} else {TESTS_FAILURES.push_back(LOCATION + " (" + n + ")"); if (!TESTS_SILENT) {std::cout << T_RED << "TEST \"" << n << "\" FAILED @ " << LOCATION << T_RESET << std::endl << "\twhere " << #x << " (" << (x) << ") was FALSE" << std::endl;}}
-#define TEST_EQ(x, y) TESTS_TOTAL++; if (x == y) {TESTS_SUCCESSFUL++; if (!TESTS_SILENT) {std::cout << T_GREEN << "test passed @ " << LOCATION << T_RESET << std::endl;}} else {TESTS_FAILURES.push_back(LOCATION); if (!TESTS_SILENT) {std::cout << T_RED << "TEST FAILED @ " << LOCATION << T_RESET << std::endl << "\tequating " << #x << " (" << x << ") to " << #y << " (" << y << ")" << std::endl;}}
-#define TEST_NAMED_EQ(n, x, y) TESTS_TOTAL++; if (x == y) {TESTS_SUCCESSFUL++; if (!TESTS_SILENT) {std::cout << T_GREEN << "test \"" << n << "\" passed @ " << LOCATION << T_RESET << std::endl;}} else {TESTS_FAILURES.push_back(LOCATION + " (" + n + ")"); if (!TESTS_SILENT) {std::cout << T_RED << "TEST \"" << n << "\" FAILED @ " << LOCATION << T_RESET << std::endl << "\tequating " << #x << " (" << x << ") to " << #y << " (" << y << ")" << std::endl;}}
-#define TEST_EPSILON_EQ(x, y, e) TESTS_TOTAL++; if (abs(x - y) <= e) {TESTS_SUCCESSFUL++; if (!TESTS_SILENT) {std::cout << T_GREEN << "test passed @ " << LOCATION << T_RESET << std::endl;}} else {TESTS_FAILURES.push_back(LOCATION); if (!TESTS_SILENT) {std::cout << T_RED << "TEST FAILED @ " << LOCATION << T_RESET << std::endl << "\tequating " << #x << " (" << x << ") to " << #y << " (" << y << ")" << " with epsilon " << e << std::endl;}}
-#define TEST_NEQ(x, y) TESTS_TOTAL++; if (x != y) {TESTS_SUCCESSFUL++; if (!TESTS_SILENT) {std::cout << T_GREEN << "test passed @ " << LOCATION << T_RESET << std::endl;}} else {TESTS_FAILURES.push_back(LOCATION); if (!TESTS_SILENT) {std::cout << T_RED << "TEST FAILED @ " << LOCATION << T_RESET << std::endl << "\tinequating " << #x << " (" << x << ") to " << #y << " (" << y << ")" << std::endl;}}
-#define TEST_NAMED_NEQ(n, x, y) TESTS_TOTAL++; if (x != y) {TESTS_SUCCESSFUL++; if (!TESTS_SILENT) {std::cout << T_GREEN << "test \"" << n << "\" passed @ " << LOCATION << T_RESET << std::endl;}} else {TESTS_FAILURES.push_back(LOCATION + " (" + n + ")"); if (!TESTS_SILENT) {std::cout << T_RED << "TEST \"" << n << "\" FAILED @ " << LOCATION << T_RESET << std::endl << "\tinequating " << #x << " (" << x << ") to " << #y << " (" << y << ")" << std::endl;}}
-#define TEST_EPSILON_NEQ(x, y, e) TESTS_TOTAL++; if (abs(x - y) > e) {TESTS_SUCCESSFUL++; if (!TESTS_SILENT) {std::cout << T_GREEN << "test passed @ " << LOCATION << T_RESET << std::endl;}} else {TESTS_FAILURES.push_back(LOCATION); if (!TESTS_SILENT) {std::cout << T_RED << "TEST FAILED @ " << LOCATION << T_RESET << std::endl << "\tinequating " << #x << " (" << x << ") to " << #y << " (" << y << ")" << " with epsilon " << e << std::endl;}}
-#define TEST_SUMMARY() std::cout << T_CYAN << "+--------------+\n| TEST SUMMARY |\n+--------------+\n" << T_GREEN << "Passed " << TESTS_SUCCESSFUL << "/" << TESTS_TOTAL << " tests (" << (TESTS_SUCCESSFUL/(float)TESTS_TOTAL)*100.0 << "%)" << T_RESET << std::endl; if (TESTS_FAILURES.size() > 0) {std::cout << T_RED << "Failed tests:" << T_RESET << std::endl; for (const std::string& s : TESTS_FAILURES) {std::cout << "    " << s << std::endl;}}
+// A rows x columns floating-point matrix of any size, stored contiguously in row-major order
+// Element (row, column) is values[row * columns + column], also available as matrix(row, column)
+struct Matrix {
+    size_t rows = 0;
+    size_t columns = 0;
+    std::vector<float, AlignedAllocator<float>> values;
 
-// Other Macros
-#define TIME(x) {auto start = std::chrono::high_resolution_clock::now(); x; auto end = std::chrono::high_resolution_clock::now(); std::cout << T_CYAN << "Ended timed section @ " << LOCATION << " in " << T_GREEN << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << T_RESET << std::endl;}
-#define TIME_NAMED(n, x) {auto start = std::chrono::high_resolution_clock::now(); x; auto end = std::chrono::high_resolution_clock::now(); std::cout << T_CYAN << "Ended timed section \"" << n << "\" @ " << LOCATION << " in " << T_GREEN << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << T_RESET << std::endl;}
+    Matrix() {}
+    Matrix(size_t matrix_rows, size_t matrix_columns, float value = 0.0f) : rows(matrix_rows), columns(matrix_columns), values(matrix_rows * matrix_columns, value) {}
 
-// Begin Alexandria namespace
-#ifdef USE_ALEXANDRIA_NAMESPACE
-namespace Alexandria {
-#endif
+    float operator()(size_t row, size_t column) const {return values[row * columns + column];}
+    float& operator()(size_t row, size_t column) {return values[row * columns + column];}
 
-////////// STRUCTS //////////
+    // Changes the shape, keeping the storage (but not the layout of values) whenever it is large enough
+    void resize(size_t matrix_rows, size_t matrix_columns) {
+        rows = matrix_rows;
+        columns = matrix_columns;
+        values.resize(rows * columns);
+    }
+
+    // Converts from a nested-vector matrix indexed as nested[row][column], such as those given to matrix_multiply
+    static Matrix from_nested(const std::vector<std::vector<float>>& nested) {
+        Matrix result(nested.size(), nested.empty() ? 0 : nested[0].size());
+        for (size_t row = 0; row < result.rows; row++) {
+            if (nested[row].size() != result.columns) {
+                throw std::invalid_argument("Matrix conversion only defined for nested vectors whose rows are all the same size.");
+            }
+            std::copy(nested[row].begin(), nested[row].end(), result.values.begin() + row * result.columns); // Not &result(row, 0), which indexes past an empty row
+        }
+        return result;
+    }
 
-// Ultra-basic 2D point
-struct Point2 {
-    int x;
-    int y;
+    // Converts to a nested-vector matrix indexed as nested[row][column]
+    std::vector<std::vector<float>> to_nested() const {
+        std::vector<std::vector<float>> nested(rows);
+        for (size_t row = 0; row < rows; row++) {
+            nested[row].assign(values.begin() + row * columns, values.begin() + (row + 1) * columns);
+        }
+        return nested;
+    }
 };
 
-// Point2 streaming/printing
-std::ostream& operator << (std::ostream& out, const Point2& rhs) {
-    out << "(" << rhs.x << ", " << rhs.y << ")";
+// Matrix streaming/printing, one bracketed row after another
+std::ostream& operator << (std::ostream& out, const Matrix& rhs) {
+    out << "[";
+    for (size_t row = 0; row < rhs.rows; row++) {
+        out << (row ? ", [" : "[");
+        for (size_t column = 0; column < rhs.columns; column++) {
+            out << (column ? ", " : "") << rhs(row, column);
+        }
+        out << "]";
+    }
+    out << "]";
     return out;
 }
 
-// Ultra-basic 3D point
-struct Point3 {
-    int x;
-    int y;
-    int z;
-};
+// Shape of the matrix multiplication micro-kernel: it keeps a MATRIX_KERNEL_ROWS x MATRIX_KERNEL_COLUMNS tile of the result in registers
+// 6 rows of 2 lanes is 12 accumulators, plus 2 for rhs and 1 for lhs, which fits the 16 registers of SSE and AVX
+#define MATRIX_KERNEL_ROWS 6
+#define MATRIX_KERNEL_COLUMNS (2 * SimdLanes::width)
+
+// Packs a rows x depth block of lhs (starting at source, with stride floats per row) into slivers of MATRIX_KERNEL_ROWS rows, stored column by column
+// Rows past the end of the block are zero, so the micro-kernel never needs to check them
+void matrix_pack_lhs(const float* source, size_t stride, size_t rows, size_t depth, float* packed) {
+    for (size_t sliver = 0; sliver < rows; sliver += MATRIX_KERNEL_ROWS) {
+        size_t sliver_rows = std::min<size_t>(MATRIX_KERNEL_ROWS, rows - sliver);
+        for (size_t k = 0; k < depth; k++) {
+            for (size_t r = 0; r < MATRIX_KERNEL_ROWS; r++) {
+                *packed++ = r < sliver_rows ? source[(sliver + r) * stride + k] : 0.0f;
+            }
+        }
+    }
+}
 
-// Point3 streaming/printing
-std::ostream& operator << (std::ostream& out, const Point3& rhs) {
-    out << "(" << rhs.x << ", " << rhs.y << ", " << rhs.z << ")";
-    return out;
+// Packs a depth x columns panel of rhs (starting at source, with stride floats per row) into slivers of MATRIX_KERNEL_COLUMNS columns, stored row by row
+// Columns past the end of the panel are zero, so the micro-kernel never needs to check them
+void matrix_pack_rhs(const float* source, size_t stride, size_t depth, size_t columns, float* packed) {
+    for (size_t sliver = 0; sliver < columns; sliver += MATRIX_KERNEL_COLUMNS) {
+        size_t sliver_columns = std::min<size_t>(MATRIX_KERNEL_COLUMNS, columns - sliver);
+        for (size_t k = 0; k < depth; k++) {
+            const float* row = source + k * stride + sliver;
+            for (size_t c = 0; c < MATRIX_KERNEL_COLUMNS; c++) {
+                *packed++ = c < sliver_columns ? row[c] : 0.0f;
+            }
+        }
+    }
 }
 
-// A basic 3D floating-point vector
-struct Vector3 {
-    float x;
-    float y;
-    float z;
-};
+// Adds the product of a packed lhs sliver and a packed rhs sliver into a rows x columns tile of out (with stride floats per row)
+// The whole tile is accumulated in registers. Partial tiles at the edges of out go through a small buffer instead
+void matrix_kernel(size_t depth, const float* lhs, const float* rhs, float* out, size_t stride, size_t rows, size_t columns) {
+    typedef SimdLanes L;
+    const size_t w = L::width;
+    L c00 = L::broadcast(0.0f), c01 = c00, c10 = c00, c11 = c00, c20 = c00, c21 = c00;
+    L c30 = c00, c31 = c00, c40 = c00, c41 = c00, c50 = c00, c51 = c00;
+    for (size_t k = 0; k < depth; k++) {
+        L b0 = L::load(rhs);
+        L b1 = L::load(rhs + w);
+        L a = L::broadcast(lhs[0]);
+        c00 = simd_multiply_add(a, b0, c00);
+        c01 = simd_multiply_add(a, b1, c01);
+        a = L::broadcast(lhs[1]);
+        c10 = simd_multiply_add(a, b0, c10);
+        c11 = simd_multiply_add(a, b1, c11);
+        a = L::broadcast(lhs[2]);
+        c20 = simd_multiply_add(a, b0, c20);
+        c21 = simd_multiply_add(a, b1, c21);
+        a = L::broadcast(lhs[3]);
+        c30 = simd_multiply_add(a, b0, c30);
+        c31 = simd_multiply_add(a, b1, c31);
+        a = L::broadcast(lhs[4]);
+        c40 = simd_multiply_add(a, b0, c40);
+        c41 = simd_multiply_add(a, b1, c41);
+        a = L::broadcast(lhs[5]);
+        c50 = simd_multiply_add(a, b0, c50);
+        c51 = simd_multiply_add(a, b1, c51);
+        lhs += MATRIX_KERNEL_ROWS;
+        rhs += MATRIX_KERNEL_COLUMNS;
+    }
 
-// Vector streaming/printing
-std::ostream& operator << (std::ostream& out, const Vector3& rhs) {
-    out << "<" << rhs.x << ", " << rhs.y << ", " << rhs.z << ">";
-    return out;
+    const L tile[MATRIX_KERNEL_ROWS][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+    if (rows == MATRIX_KERNEL_ROWS && columns == MATRIX_KERNEL_COLUMNS) {
+        for (size_t r = 0; r < MATRIX_KERNEL_ROWS; r++) {
+            (L::load(out + r * stride) + tile[r][0]).store(out + r * stride);
+            (L::load(out + r * stride + w) + tile[r][1]).store(out + r * stride + w);
+        }
+    } else {
+        float buffer[MATRIX_KERNEL_ROWS * 2 * L::width];
+        for (size_t r = 0; r < rows; r++) {
+            tile[r][0].store(buffer + r * 2 * w);
+            tile[r][1].store(buffer + r * 2 * w + w);
+            for (size_t c = 0; c < columns; c++) {
+                out[r * stride + c] += buffer[r * 2 * w + c];
+            }
+        }
+    }
 }
 
-// Vector-matrix functions
-Vector3 operator*(std::vector<std::vector<float>> const& lhs, Vector3 const& rhs) {
-    // Throw an error if the vector is not the right size
-    if (lhs.size() != 3 || lhs[0].size() != 3) {
-        throw std::invalid_argument("Vector3 matrix multiplication only defined for 3x3 floating-point matrices.");
+// Computes one tile of out = lhs * rhs: the rows [row, row + rows) and columns [column, column + columns), over the whole inner dimension
+// packed_lhs and packed_rhs are scratch space for one block of each, with rows and columns rounded up to the micro-kernel's tile
+void matrix_multiply_tile(const Matrix& lhs, const Matrix& rhs, Matrix& out, size_t row, size_t rows, size_t column, size_t columns, float* packed_lhs, float* packed_rhs) {
+    for (size_t r = row; r < row + rows; r++) {
+        std::fill(&out.values[r * out.columns + column], &out.values[r * out.columns + column] + columns, 0.0f);
     }
+    for (size_t k = 0; k < lhs.columns; k += MATRIX_BLOCK_DEPTH) {
+        size_t depth = std::min<size_t>(MATRIX_BLOCK_DEPTH, lhs.columns - k);
+        matrix_pack_rhs(&rhs.values[k * rhs.columns + column], rhs.columns, depth, columns, packed_rhs);
+        matrix_pack_lhs(&lhs.values[row * lhs.columns + k], lhs.columns, rows, depth, packed_lhs);
+        for (size_t j = 0; j < columns; j += MATRIX_KERNEL_COLUMNS) {
+            for (size_t i = 0; i < rows; i += MATRIX_KERNEL_ROWS) {
+                matrix_kernel(depth, packed_lhs + i * depth, packed_rhs + j * depth, &out.values[(row + i) * out.columns + column + j], out.columns,
+                              std::min<size_t>(MATRIX_KERNEL_ROWS, rows - i), std::min<size_t>(MATRIX_KERNEL_COLUMNS, columns - j));
+            }
+        }
+    }
+}
 
-    return (Vector3){
-        lhs[0][0]*rhs.x + lhs[1][0]*rhs.y + lhs[2][0]*rhs.z,
-        lhs[0][1]*rhs.x + lhs[1][1]*rhs.y + lhs[2][1]*rhs.z,
-        lhs[0][2]*rhs.x + lhs[1][2]*rhs.y + lhs[2][2]*rhs.z,
+// Multiplies lhs (n*m) by rhs (m*p) into out, which is resized to n*p (reusing its storage) and may be either input
+// The work is split into tiles of MATRIX_BLOCK_ROWS x MATRIX_BLOCK_COLUMNS, which are shared out across threads once there are more than
+//  MATRIX_PARALLEL_THRESHOLD multiply-adds. threads = 0 uses every hardware thread, and threads = 1 always stays on the calling thread
+void matrix_multiply(const Matrix& lhs, const Matrix& rhs, Matrix& out, unsigned int threads = 0) {
+    if (lhs.columns != rhs.rows) {
+        throw std::invalid_argument("Matrix multiplication only defined for matrices of shapes n*m & m*p");
+    }
+    if (&out == &lhs || &out == &rhs) {
+        Matrix result;
+        matrix_multiply(lhs, rhs, result, threads);
+        std::swap(out, result);
+        return;
+    }
+    out.resize(lhs.rows, rhs.columns);
+    if (out.values.empty()) {
+        return;
+    }
+    if ((double)lhs.rows * lhs.columns * rhs.columns <= MATRIX_SMALL_THRESHOLD) {
+        // Small enough to stay in cache without blocking, so a plain row-by-row loop (which the compiler vectorizes) beats packing
+        for (size_t i = 0; i < lhs.rows; i++) {
+            float* out_row = &out.values[i * out.columns];
+            std::fill(out_row, out_row + out.columns, 0.0f);
+            for (size_t k = 0; k < lhs.columns; k++) {
+                float a = lhs(i, k);
+                const float* rhs_row = &rhs.values[k * rhs.columns];
+                for (size_t j = 0; j < rhs.columns; j++) {
+                    out_row[j] += a * rhs_row[j];
+                }
+            }
+        }
+        return;
+    }
+
+    const size_t block_rows = (MATRIX_BLOCK_ROWS + MATRIX_KERNEL_ROWS - 1) / MATRIX_KERNEL_ROWS * MATRIX_KERNEL_ROWS;
+    const size_t block_columns = (MATRIX_BLOCK_COLUMNS + MATRIX_KERNEL_COLUMNS - 1) / MATRIX_KERNEL_COLUMNS * MATRIX_KERNEL_COLUMNS;
+    const size_t row_tiles = (out.rows + block_rows - 1) / block_rows;
+    const size_t column_tiles = (out.columns + block_columns - 1) / block_columns;
+    const size_t tiles = row_tiles * column_tiles;
+
+    if ((double)lhs.rows * lhs.columns * rhs.columns < MATRIX_PARALLEL_THRESHOLD) {
+        threads = 1;
+    }
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = (unsigned int)std::min<size_t>(threads, tiles);
+
+    std::atomic<size_t> next_tile(0); // Index of the next tile to be picked up by a free worker
+    // Scratch space is sized to the matrices, so that small multiplications don't pay for whole blocks
+    const size_t packed_rows = std::min(block_rows, (out.rows + MATRIX_KERNEL_ROWS - 1) / MATRIX_KERNEL_ROWS * MATRIX_KERNEL_ROWS);
+    const size_t packed_columns = std::min(block_columns, (out.columns + MATRIX_KERNEL_COLUMNS - 1) / MATRIX_KERNEL_COLUMNS * MATRIX_KERNEL_COLUMNS);
+    const size_t packed_depth = std::min<size_t>(MATRIX_BLOCK_DEPTH, lhs.columns);
+    auto worker = [&]() {
+        std::vector<float, AlignedAllocator<float>> packed_lhs(packed_rows * packed_depth);
+        std::vector<float, AlignedAllocator<float>> packed_rhs(packed_depth * packed_columns);
+        for (size_t tile = next_tile++; tile < tiles; tile = next_tile++) {
+            size_t row = (tile / column_tiles) * block_rows;
+            size_t column = (tile % column_tiles) * block_columns;
+            matrix_multiply_tile(lhs, rhs, out, row, std::min(block_rows, out.rows - row), column, std::min(block_columns, out.columns - column),
+                                 packed_lhs.data(), packed_rhs.data());
+        }
     };
+
+    // The calling thread works alongside the pool instead of idling
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : pool) {
+        t.join();
+    }
 }
 
-// Vector 3 math source: audeo C++ library
-Vector3 operator-(Vector3 const& lhs, Vector3 const& rhs) {
-    return Vector3{lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z};
+// Returning version of matrix_multiply, for when the output isn't being reused
+Matrix matrix_multiply(const Matrix& lhs, const Matrix& rhs, unsigned int threads = 0) {
+    Matrix out;
+    matrix_multiply(lhs, rhs, out, threads);
+    return out;
+}
+
+// Batch transform settings, which may be defined before including this file to override them
+#ifndef TRANSFORM_PARALLEL_THRESHOLD
+#define TRANSFORM_PARALLEL_THRESHOLD 262144 // Vectors below which transform() stays on the calling thread, as a thread costs about as much as transforming tens of thousands
+#endif
+
+// Runs function(begin, end) over [0, count) split into one contiguous range per thread, each a multiple of alignment long (except the last)
+// Stays on the calling thread below threshold. threads = 0 uses every hardware thread
+template <typename F>
+void parallel_for_range(size_t count, size_t threshold, unsigned int threads, size_t alignment, F function) {
+    if (count < threshold || threads == 1) {
+        function((size_t)0, count);
+        return;
+    }
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Never more threads than there are aligned chunks, and never an empty chunk, which would never advance through the range
+    threads = (unsigned int)std::min((size_t)threads, std::max((size_t)1, count / alignment));
+    if (threads == 1) {
+        function((size_t)0, count);
+        return;
+    }
+    size_t chunk = std::max(alignment, (count / threads + alignment - 1) / alignment * alignment);
+    std::vector<std::thread> pool;
+    for (size_t begin = chunk; begin < count; begin += chunk) {
+        pool.emplace_back(function, begin, std::min(begin + chunk, count));
+    }
+    // The calling thread works alongside the pool instead of idling
+    function((size_t)0, std::min(chunk, count));
+    for (std::thread& t : pool) {
+        t.join();
+    }
 }
 
-Vector3 operator+(Vector3 const& lhs, Vector3 const& rhs) {
-    return Vector3{lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z};
+static_assert(sizeof(Vector3) == 3 * sizeof(float) && sizeof(Point3) == 3 * sizeof(int), "transform() reads Vector3 and Point3 arrays as packed floats and ints");
+
+// Rows of an affine transform, with the translation as each row's last element. Matrix3 transforms have no translation
+struct TransformRows {
+    float m[12];
+};
+inline TransformRows transform_rows(const Matrix3& matrix) {
+    return TransformRows{{matrix(0, 0), matrix(0, 1), matrix(0, 2), 0.0f, matrix(1, 0), matrix(1, 1), matrix(1, 2), 0.0f, matrix(2, 0), matrix(2, 1), matrix(2, 2), 0.0f}};
+}
+inline TransformRows transform_rows(const Matrix4& matrix) {
+    return TransformRows{{matrix(0, 0), matrix(0, 1), matrix(0, 2), matrix(0, 3), matrix(1, 0), matrix(1, 1), matrix(1, 2), matrix(1, 3), matrix(2, 0), matrix(2, 1), matrix(2, 2), matrix(2, 3)}};
 }
 
-Vector3 operator*(Vector3 const& lhs, float scalar) {
-    return {lhs.x * scalar, lhs.y * scalar, lhs.z * scalar};
+// Transforms one vector or point, for the ends of batches
+inline Vector3 transform_one(const TransformRows& rows, const Vector3& v) {
+    const float* m = rows.m;
+    return Vector3{m[0] * v.x + m[1] * v.y + m[2] * v.z + m[3], m[4] * v.x + m[5] * v.y + m[6] * v.z + m[7], m[8] * v.x + m[9] * v.y + m[10] * v.z + m[11]};
+}
+inline Vector3 transform_one(const TransformRows& rows, const Point3& p) {
+    return transform_one(rows, Vector3{(float)p.x, (float)p.y, (float)p.z});
 }
 
-Vector3 operator/(Vector3 const& lhs, float scalar) {
-    return {lhs.x / scalar, lhs.y / scalar, lhs.z / scalar};
+#ifdef ALEXANDRIA_SSE_AVAILABLE
+// Loads 4 packed Vector3 (12 floats, as 3 registers) and transposes them into registers of 4 x, 4 y, and 4 z
+inline void transform_load4(const Vector3* in, __m128& x, __m128& y, __m128& z) {
+    const float* f = &in->x;
+    __m128 a = _mm_loadu_ps(f);     // x0 y0 z0 x1
+    __m128 b = _mm_loadu_ps(f + 4); // y1 z1 x2 y2
+    __m128 c = _mm_loadu_ps(f + 8); // z2 x3 y3 z3
+    x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+    y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
 }
 
-// Returns the magnitude of a Vector3
-float magnitude(Vector3 v) {
-    return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+// Loads 4 packed Point3 the same way, converting them to floats
+inline void transform_load4(const Point3* in, __m128& x, __m128& y, __m128& z) {
+    const int* i = &in->x;
+    __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)i));
+    __m128 b = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(i + 4)));
+    __m128 c = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(i + 8)));
+    x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+    y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
 }
 
-// Returns a normalized Vector3
-Vector3 normalize(Vector3 v) { return v * (1.0f / magnitude(v)); }
+// Transposes registers of 4 x, 4 y, and 4 z back into 4 packed Vector3 and stores them
+inline void transform_store4(Vector3* out, __m128 x, __m128 y, __m128 z) {
+    float* f = &out->x;
+    _mm_storeu_ps(f, _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(f + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(f + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+#endif
+
+// Transforms in[begin, end) into out[begin, end), 4 at a time with the whole matrix held in registers. in and out may be the same array
+template <typename T>
+void transform_range(const TransformRows& matrix_rows, const T* in, Vector3* out, size_t begin, size_t end) {
+    const TransformRows rows = matrix_rows; // A local copy, which the compiler knows out can't overwrite, so it stays in registers
+    size_t i = begin;
+#ifdef ALEXANDRIA_SSE_AVAILABLE
+    typedef SimdLanesSSE L;
+    const L m00 = L::broadcast(rows.m[0]), m01 = L::broadcast(rows.m[1]), m02 = L::broadcast(rows.m[2]), m03 = L::broadcast(rows.m[3]);
+    const L m10 = L::broadcast(rows.m[4]), m11 = L::broadcast(rows.m[5]), m12 = L::broadcast(rows.m[6]), m13 = L::broadcast(rows.m[7]);
+    const L m20 = L::broadcast(rows.m[8]), m21 = L::broadcast(rows.m[9]), m22 = L::broadcast(rows.m[10]), m23 = L::broadcast(rows.m[11]);
+    for (; i + 4 <= end; i += 4) {
+        L x, y, z;
+        transform_load4(in + i, x.v, y.v, z.v);
+        L tx = simd_multiply_add(m02, z, simd_multiply_add(m01, y, simd_multiply_add(m00, x, m03)));
+        L ty = simd_multiply_add(m12, z, simd_multiply_add(m11, y, simd_multiply_add(m10, x, m13)));
+        L tz = simd_multiply_add(m22, z, simd_multiply_add(m21, y, simd_multiply_add(m20, x, m23)));
+        transform_store4(out + i, tx.v, ty.v, tz.v);
+    }
+#endif
+    for (; i < end; i++) {
+        out[i] = transform_one(rows, in[i]);
+    }
+}
 
-// Returns the cross product of two Vector3
-Vector3 cross(Vector3 const& lhs, Vector3 const& rhs) {
-    return {lhs.y * rhs.z - lhs.z * rhs.y, lhs.z * rhs.x - lhs.x * rhs.z,
-            lhs.x * rhs.y - lhs.y * rhs.x};
+// Transforms every vector in place (or into out, which is resized to fit) by a Matrix3, the same as matrix * vector for each
+// Arrays of TRANSFORM_PARALLEL_THRESHOLD or more are split across threads (0 = every hardware thread)
+void transform(const Matrix3& matrix, const std::vector<Vector3>& vectors, std::vector<Vector3>& out, unsigned int threads = 0) {
+    out.resize(vectors.size());
+    TransformRows rows = transform_rows(matrix);
+    parallel_for_range(vectors.size(), TRANSFORM_PARALLEL_THRESHOLD, threads, 4, [&](size_t begin, size_t end) {transform_range(rows, vectors.data(), out.data(), begin, end);});
 }
 
-// Returns the dot product of two Vector3
-float dot(Vector3 const& lhs, Vector3 const& rhs) {
-    return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z;
+// Transforms every vector as a point (w = 1) by a Matrix4, the same as matrix * vector for each (so the bottom row is ignored)
+void transform(const Matrix4& matrix, const std::vector<Vector3>& vectors, std::vector<Vector3>& out, unsigned int threads = 0) {
+    out.resize(vectors.size());
+    TransformRows rows = transform_rows(matrix);
+    parallel_for_range(vectors.size(), TRANSFORM_PARALLEL_THRESHOLD, threads, 4, [&](size_t begin, size_t end) {transform_range(rows, vectors.data(), out.data(), begin, end);});
 }
 
-// Returns the angle between two Vector3
-float angle(Vector3 const& lhs, Vector3 const& rhs) {
-    // The cosine of the angle between two vectors is equal to the dot product
-    // of the vectors divided by the product of the magnitude of the vectors
-    //
-    // We get rid of the division by normalizing the vectors
-    Vector3 a = normalize(lhs);
-    Vector3 b = normalize(rhs);
-    // The cosine is now equal to the dot product of a and b
-    float cos_a = dot(a, b);
-    // Convert this cosine to an angle in degrees and we are done
-    return static_cast<float>(std::acos(cos_a) * 180.0f / M_PI);
+// Transforms every integer point, converted to float, by a Matrix3
+void transform(const Matrix3& matrix, const std::vector<Point3>& points, std::vector<Vector3>& out, unsigned int threads = 0) {
+    out.resize(points.size());
+    TransformRows rows = transform_rows(matrix);
+    parallel_for_range(points.size(), TRANSFORM_PARALLEL_THRESHOLD, threads, 4, [&](size_t begin, size_t end) {transform_range(rows, points.data(), out.data(), begin, end);});
 }
 
+// Transforms every integer point, converted to float, by a Matrix4 (w = 1, bottom row ignored)
+void transform(const Matrix4& matrix, const std::vector<Point3>& points, std::vector<Vector3>& out, unsigned int threads = 0) {
+    out.resize(points.size());
+    TransformRows rows = transform_rows(matrix);
+    parallel_for_range(points.size(), TRANSFORM_PARALLEL_THRESHOLD, threads, 4, [&](size_t begin, size_t end) {transform_range(rows, points.data(), out.data(), begin, end);});
+}
+
+// Transforms every vector of a Vector3Array, which needs no transposing as it is already stored as x, y, and z arrays
+void transform_array(const TransformRows& rows, const Vector3Array& vectors, Vector3Array& out, unsigned int threads) {
+    out.resize(vectors.size());
+    parallel_for_range(vectors.size(), TRANSFORM_PARALLEL_THRESHOLD, threads, SimdLanes::width, [&](size_t begin, size_t end) {
+        simd_for_each(end - begin, [&](auto lanes, size_t i) {
+            typedef decltype(lanes) L;
+            i += begin;
+            L x = L::load(&vectors.x[i]), y = L::load(&vectors.y[i]), z = L::load(&vectors.z[i]);
+            simd_multiply_add(L::broadcast(rows.m[2]), z, simd_multiply_add(L::broadcast(rows.m[1]), y, simd_multiply_add(L::broadcast(rows.m[0]), x, L::broadcast(rows.m[3])))).store(&out.x[i]);
+            simd_multiply_add(L::broadcast(rows.m[6]), z, simd_multiply_add(L::broadcast(rows.m[5]), y, simd_multiply_add(L::broadcast(rows.m[4]), x, L::broadcast(rows.m[7])))).store(&out.y[i]);
+            simd_multiply_add(L::broadcast(rows.m[10]), z, simd_multiply_add(L::broadcast(rows.m[9]), y, simd_multiply_add(L::broadcast(rows.m[8]), x, L::broadcast(rows.m[11])))).store(&out.z[i]);
+        });
+    });
+}
+void transform(const Matrix3& matrix, const Vector3Array& vectors, Vector3Array& out, unsigned int threads = 0) {transform_array(transform_rows(matrix), vectors, out, threads);}
+void transform(const Matrix4& matrix, const Vector3Array& vectors, Vector3Array& out, unsigned int threads = 0) {transform_array(transform_rows(matrix), vectors, out, threads);}
+
+// Returning versions of transform, for when the output isn't being reused
+std::vector<Vector3> transform(const Matrix3& matrix, const std::vector<Vector3>& vectors, unsigned int threads = 0) {std::vector<Vector3> out; transform(matrix, vectors, out, threads); return out;}
+std::vector<Vector3> transform(const Matrix4& matrix, const std::vector<Vector3>& vectors, unsigned int threads = 0) {std::vector<Vector3> out; transform(matrix, vectors, out, threads); return out;}
+std::vector<Vector3> transform(const Matrix3& matrix, const std::vector<Point3>& points, unsigned int threads = 0) {std::vector<Vector3> out; transform(matrix, points, out, threads); return out;}
+std::vector<Vector3> transform(const Matrix4& matrix, const std::vector<Point3>& points, unsigned int threads = 0) {std::vector<Vector3> out; transform(matrix, points, out, threads); return out;}
+Vector3Array transform(const Matrix3& matrix, const Vector3Array& vectors, unsigned int threads = 0) {Vector3Array out; transform(matrix, vectors, out, threads); return out;}
+Vector3Array transform(const Matrix4& matrix, const Vector3Array& vectors, unsigned int threads = 0) {Vector3Array out; transform(matrix, vectors, out, threads); return out;}
+
 // A small RGB 256-bit color
 struct Color {
     uint8_t r;
@@ -619,33 +5350,16 @@ std::vector<std::vector<float>> make_matrix_3x3(bool identity = true) {
     }
 }
 
-// Multiplies two matrices of identical dimensions together
+// Multiplies two nested-vector matrices (indexed as [row][column]) together, through the contiguous Matrix version
 std::vector<std::vector<float>> matrix_multiply(std::vector<std::vector<float>>& lhs, std::vector<std::vector<float>>& rhs) {
     // Validate matrix sizes
     if (lhs[0].size() != rhs.size()) {
         throw std::invalid_argument("Matrix multiplication only defined for matrices of shapes n*m & m*p");
     }
 
-    // Helpful defines
-    int n = lhs.size();
-    int m = lhs[0].size();
-    int p = rhs[0].size();
-
-    // Make a new matrix of the correct size (n*p)
-    std::vector<std::vector<float>> result = std::vector<std::vector<float>>(n, std::vector<float>(p, 0.0));
-
-    // Multiply
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < p; j++) {
-            float acc = 0;
-            for (int k = 0; k < m; k++) {
-                acc += lhs[i][k] * rhs[k][j];
-            }
-            result[i][j] = acc;
-        }
-    }
-
-    return result;
+    Matrix result;
+    matrix_multiply(Matrix::from_nested(lhs), Matrix::from_nested(rhs), result);
+    return result.to_nested();
 }
 
 
@@ -1163,7 +5877,14 @@ std::string get_os() {
 //  Executable path: get_abs_path(std::string(argv[0]))
 // Source: https://pubs.opengroup.org/onlinepubs/000095399/functions/realpath.html
 std::string get_abs_path(std::string file) {
+    #ifdef _WIN32
     char* path_ptr = _fullpath(NULL, file.c_str(), 100);
+    #else
+    char* path_ptr = realpath(file.c_str(), NULL);
+    if (path_ptr == NULL) {
+        return ""; // Path does not exist
+    }
+    #endif
     std::string result(path_ptr);
     free(path_ptr);
     return result;
@@ -1657,7 +6378,7 @@ public:
     Circle& operator+=(int delta) {
         if (contents.size() == 0) {throw std::out_of_range("Attempted to advance index of buffer of size 0");} // No data
         index += delta;
-        while (index >= contents.size()) {
+        while (index >= (int)contents.size()) {
             index -= contents.size();
         }
         while (index < 0) {
@@ -1670,7 +6391,7 @@ public:
     Circle& operator-=(int delta) {
         if (contents.size() == 0) {throw std::out_of_range("Attempted to retreat index of buffer of size 0");} // No data
         index -= delta;
-        while (index >= contents.size()) {
+        while (index >= (int)contents.size()) {
             index -= contents.size();
         }
         while (index < 0) {
@@ -1715,7 +6436,7 @@ public:
     T& operator[](int offset) {
         if (contents.size() == 0) {throw std::out_of_range("Attempted to access element of buffer of size 0");} // No data
         int target = index + offset;
-        while (target >= contents.size()) {
+        while (target >= (int)contents.size()) {
             target -= contents.size();
         }
         while (target < 0) {
@@ -0,0 +1,362 @@
+/*
+
+Benchmark suite for the hot functions of the Alexandria Library
+
+Build:
+    g++ -std=c++14 -O2 -pthread alexandria_benchmark.cpp -o alexandria_benchmark
+    Add -march=native (or -mavx2) to benchmark the AVX kernels of Vector3Array rather than the SSE ones
+
+Usage:
+    ./alexandria_benchmark [--output results.json] [--baseline baseline.json] [--threshold percent] [--filter text]
+        --output: Writes the results as JSON (default: alexandria_benchmark.json)
+        --baseline: Compares the results against an earlier output file, flagging any benchmark whose median slowed down by more than the threshold
+        --threshold: Allowed slowdown against the baseline, in percent (default: 10)
+        --filter: Only runs benchmarks whose name contains this text
+
+    To make a baseline, run once on the reference machine and keep the output file, then pass it as --baseline on later runs
+    Exits with status 1 if any benchmark regressed, so this can gate a build, and with status 2 (before running anything) if an option is unknown,
+        is missing its value, or has an invalid one, or if the baseline can't be read
+
+*/
+
+// Shorter than the defaults, as the suite runs a lot of benchmarks
+#define BENCH_WARMUP_NS 20000000
+#define BENCH_MAX_NS 500000000
+
+#include "alexandria.hpp"
+
+#include <cstdio>
+
+// All results of this run, in order
+std::vector<BenchResult> results;
+
+// Only benchmarks whose name contains this are run
+std::string name_filter = "";
+
+// Runs and records one benchmark, if it passes the filter
+template <typename F>
+void benchmark(const std::string& name, F function, double bytes = 0.0, double items = 0.0) {
+    if (name.find(name_filter) == std::string::npos) {
+        return;
+    }
+    results.push_back(run_benchmark(name, "alexandria_benchmark.cpp", function, bytes, items));
+}
+
+// Makes a JSON-like list of count numbers, such as "[0, 1, 2]"
+std::string make_list(int count) {
+    std::string list = "[";
+    for (int i = 0; i < count; i++) {
+        list += std::to_string(i) + (i + 1 < count ? ", " : "");
+    }
+    return list + "]";
+}
+
+// Makes an .ini-like list of count key/value pairs, such as "key0 = 0\nkey1 = 1"
+std::string make_ini(int count) {
+    std::string ini = "";
+    for (int i = 0; i < count; i++) {
+        ini += "key" + std::to_string(i) + " = " + std::to_string(i) + "\n";
+    }
+    return ini;
+}
+
+// Makes count lines of text, with every step-th line changed by variant
+std::string make_lines(int count, int step, int variant) {
+    std::string lines = "";
+    for (int i = 0; i < count; i++) {
+        lines += "line number " + std::to_string(i) + (i % step == 0 ? " variant " + std::to_string(variant) : "") + "\n";
+    }
+    return lines;
+}
+
+// Makes a size*size matrix filled with small values
+std::vector<std::vector<float>> make_matrix(int size) {
+    std::vector<std::vector<float>> matrix(size, std::vector<float>(size));
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            matrix[i][j] = (float)((i * size + j) % 7) * 0.5f;
+        }
+    }
+    return matrix;
+}
+
+// Benchmarks of the string functions
+void benchmark_strings() {
+    for (int size : {64, 4096, 262144}) {
+        std::string raw(size, 'a');
+        for (int i = 0; i < size; i++) {
+            raw[i] = (char)(i * 31);
+        }
+        std::string encoded = base64_encode(raw);
+        benchmark("base64_encode/" + std::to_string(size), [&]() {return base64_encode(raw);}, size);
+        benchmark("base64_decode/" + std::to_string(size), [&]() {return base64_decode(encoded);}, size);
+    }
+
+    for (int count : {16, 1024, 65536}) {
+        std::string list = make_list(count);
+        std::string ini = make_ini(count);
+        benchmark("extract_vector/" + std::to_string(count), [&]() {return extract_vector(list);}, list.size(), count);
+        benchmark("extract_map/" + std::to_string(count), [&]() {return extract_map(ini);}, ini.size(), count);
+        benchmark("split/" + std::to_string(count), [&]() {return split(ini);}, ini.size(), count);
+    }
+
+    // diff prints its result, so that output is discarded while it runs
+    for (int count : {16, 256}) {
+        std::string a = make_lines(count, 5, 0);
+        std::string b = make_lines(count, 7, 1);
+        std::ostringstream discarded;
+        std::streambuf* original = std::cout.rdbuf(discarded.rdbuf());
+        benchmark("diff/" + std::to_string(count), [&]() {diff(a, b); discarded.str("");}, 0.0, count);
+        std::cout.rdbuf(original);
+        if (!results.empty() && results.back().name == "diff/" + std::to_string(count)) {
+            std::cout << results.back() << std::endl; // Printed again, as the first print was discarded
+        }
+    }
+}
+
+// Benchmarks of the image and matrix functions
+void benchmark_images_and_matrices() {
+    std::string bmp_path = "alexandria_benchmark.bmp";
+    for (int size : {16, 256}) {
+        std::vector<std::vector<ColorAlpha>> pixels = make_image_array(size, size);
+        benchmark("save_bmp/" + std::to_string(size), [&]() {save_bmp(bmp_path, pixels);}, size * size * 4.0, size * size);
+    }
+    std::remove(bmp_path.c_str());
+
+    for (int size : {8, 64, 256}) {
+        std::vector<std::vector<float>> lhs = make_matrix(size);
+        std::vector<std::vector<float>> rhs = make_matrix(size);
+        benchmark("matrix_multiply/" + std::to_string(size), [&]() {return matrix_multiply(lhs, rhs);}, 0.0, 2.0 * size * size * size);
+    }
+    for (int size : {64, 256, 1024}) {
+        Matrix lhs = Matrix::from_nested(make_matrix(size));
+        Matrix rhs = Matrix::from_nested(make_matrix(size));
+        Matrix out;
+        benchmark("Matrix/multiply/" + std::to_string(size), [&]() {matrix_multiply(lhs, rhs, out, 1); do_not_optimize(out.values[0]);}, 0.0, 2.0 * size * size * size);
+        benchmark("Matrix/multiply_threaded/" + std::to_string(size), [&]() {matrix_multiply(lhs, rhs, out); do_not_optimize(out.values[0]);}, 0.0, 2.0 * size * size * size);
+    }
+}
+
+// Benchmarks of the Vector3 functions, one vector at a time against Vector3Array batches of the same vectors
+void benchmark_vectors() {
+    for (int count : {1024, 1048576}) {
+        std::vector<Vector3> lhs(count);
+        std::vector<Vector3> rhs(count);
+        for (int i = 0; i < count; i++) {
+            lhs[i] = {(float)(i % 7) + 1.0f, (float)(i % 5) - 2.0f, (float)(i % 3) + 0.5f};
+            rhs[i] = {(float)(i % 11) - 5.0f, (float)(i % 13) + 1.0f, (float)(i % 2) - 0.5f};
+        }
+        Vector3Array lhs_array(lhs);
+        Vector3Array rhs_array(rhs);
+        std::vector<Vector3> vectors(count);
+        std::vector<float> floats(count);
+        Vector3Array vectors_array(count);
+        std::string size = "/" + std::to_string(count);
+
+        benchmark("Vector3/add" + size, [&]() {for (int i = 0; i < count; i++) {vectors[i] = lhs[i] + rhs[i];} do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("Vector3Array/add" + size, [&]() {add(lhs_array, rhs_array, vectors_array); do_not_optimize(vectors_array.x[0]);}, 0.0, count);
+        benchmark("Vector3/subtract" + size, [&]() {for (int i = 0; i < count; i++) {vectors[i] = lhs[i] - rhs[i];} do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("Vector3Array/subtract" + size, [&]() {subtract(lhs_array, rhs_array, vectors_array); do_not_optimize(vectors_array.x[0]);}, 0.0, count);
+        benchmark("Vector3/scale" + size, [&]() {for (int i = 0; i < count; i++) {vectors[i] = lhs[i] * 2.5f;} do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("Vector3Array/scale" + size, [&]() {scale(lhs_array, 2.5f, vectors_array); do_not_optimize(vectors_array.x[0]);}, 0.0, count);
+        benchmark("Vector3/dot" + size, [&]() {for (int i = 0; i < count; i++) {floats[i] = dot(lhs[i], rhs[i]);} do_not_optimize(floats[0]);}, 0.0, count);
+        benchmark("Vector3Array/dot" + size, [&]() {dot(lhs_array, rhs_array, floats); do_not_optimize(floats[0]);}, 0.0, count);
+        benchmark("Vector3/cross" + size, [&]() {for (int i = 0; i < count; i++) {vectors[i] = cross(lhs[i], rhs[i]);} do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("Vector3Array/cross" + size, [&]() {cross(lhs_array, rhs_array, vectors_array); do_not_optimize(vectors_array.x[0]);}, 0.0, count);
+        benchmark("Vector3/normalize" + size, [&]() {for (int i = 0; i < count; i++) {vectors[i] = normalize(lhs[i]);} do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("Vector3Array/normalize" + size, [&]() {normalize(lhs_array, vectors_array); do_not_optimize(vectors_array.x[0]);}, 0.0, count);
+        benchmark("Vector3/magnitude" + size, [&]() {for (int i = 0; i < count; i++) {floats[i] = magnitude(lhs[i]);} do_not_optimize(floats[0]);}, 0.0, count);
+        benchmark("Vector3Array/magnitude" + size, [&]() {magnitude(lhs_array, floats); do_not_optimize(floats[0]);}, 0.0, count);
+        benchmark("Vector3/angle" + size, [&]() {for (int i = 0; i < count; i++) {floats[i] = angle(lhs[i], rhs[i]);} do_not_optimize(floats[0]);}, 0.0, count);
+        benchmark("Vector3Array/angle" + size, [&]() {angle(lhs_array, rhs_array, floats); do_not_optimize(floats[0]);}, 0.0, count);
+        benchmark("Vector3/fast_normalize" + size, [&]() {for (int i = 0; i < count; i++) {vectors[i] = fast_normalize(lhs[i]);} do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("Vector3Array/fast_normalize" + size, [&]() {fast_normalize(lhs_array, vectors_array); do_not_optimize(vectors_array.x[0]);}, 0.0, count);
+        benchmark("Vector3/fast_magnitude" + size, [&]() {for (int i = 0; i < count; i++) {floats[i] = fast_magnitude(lhs[i]);} do_not_optimize(floats[0]);}, 0.0, count);
+        benchmark("Vector3Array/fast_magnitude" + size, [&]() {fast_magnitude(lhs_array, floats); do_not_optimize(floats[0]);}, 0.0, count);
+        benchmark("Vector3/fast_angle" + size, [&]() {for (int i = 0; i < count; i++) {floats[i] = fast_angle(lhs[i], rhs[i]);} do_not_optimize(floats[0]);}, 0.0, count);
+        benchmark("Vector3Array/fast_angle" + size, [&]() {fast_angle(lhs_array, rhs_array, floats); do_not_optimize(floats[0]);}, 0.0, count);
+
+        // a + b * s - c, with c also the destination as in a particle update, eagerly (one pass per operator) and as one fused expression
+        Vector3Array temporary_array(count);
+        benchmark("Vector3/chain" + size, [&]() {for (int i = 0; i < count; i++) {vectors[i] = lhs[i] + rhs[i] * 0.5f - vectors[i];} do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("Vector3Array/chain" + size, [&]() {scale(rhs_array, 0.5f, temporary_array); add(lhs_array, temporary_array, temporary_array); subtract(temporary_array, vectors_array, vectors_array); do_not_optimize(vectors_array.x[0]);}, 0.0, count);
+        benchmark("expression/Vector3" + size, [&]() {evaluate(lazy(lhs) + lazy(rhs) * 0.5f - lazy(vectors), vectors); do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("expression/Vector3Array" + size, [&]() {vectors_array = lhs_array + rhs_array * 0.5f - vectors_array; do_not_optimize(vectors_array.x[0]);}, 0.0, count);
+
+        Matrix4 matrix = Matrix4::translation({1.0f, 2.0f, 3.0f}) * Matrix4::rotation({1.0f, 1.0f, 0.0f}, 30.0f);
+        std::vector<Point3> points(count);
+        for (int i = 0; i < count; i++) {
+            points[i] = {i % 7, i % 5, i % 3};
+        }
+        benchmark("Vector3/transform" + size, [&]() {for (int i = 0; i < count; i++) {vectors[i] = matrix * lhs[i];} do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("transform/Vector3" + size, [&]() {transform(matrix, lhs, vectors); do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("transform/Point3" + size, [&]() {transform(matrix, points, vectors); do_not_optimize(vectors[0]);}, 0.0, count);
+        benchmark("transform/Vector3Array" + size, [&]() {transform(matrix, lhs_array, vectors_array); do_not_optimize(vectors_array.x[0]);}, 0.0, count);
+    }
+}
+
+// Benchmarks of the easing functions, each evaluated over the whole [0, 1] range
+void benchmark_easing() {
+    std::vector<std::pair<std::string, double(*)(double)>> functions = {
+        {"easeLinear", &easeLinear}, {"easeInQuad", &easeInQuad}, {"easeOutQuad", &easeOutQuad}, {"easeInOutQuad", &easeInOutQuad},
+        {"easeInCubic", &easeInCubic}, {"easeOutCubic", &easeOutCubic}, {"easeInOutCubic", &easeInOutCubic},
+        {"easeInQuart", &easeInQuart}, {"easeOutQuart", &easeOutQuart}, {"easeInOutQuart", &easeInOutQuart},
+        {"easeInQuint", &easeInQuint}, {"easeOutQuint", &easeOutQuint}, {"easeInOutQuint", &easeInOutQuint},
+        {"easeInSine", &easeInSine}, {"easeOutSine", &easeOutSine}, {"easeInOutSine", &easeInOutSine},
+        {"easeInExpo", &easeInExpo}, {"easeOutExpo", &easeOutExpo}, {"easeInOutExpo", &easeInOutExpo},
+        {"easeInCirc", &easeInCirc}, {"easeOutCirc", &easeOutCirc}, {"easeInOutCirc", &easeInOutCirc},
+        {"easeInBack", &easeInBack}, {"easeOutBack", &easeOutBack}, {"easeInOutBack", &easeInOutBack},
+        {"easeInElastic", &easeInElastic}, {"easeOutElastic", &easeOutElastic}, {"easeInOutElastic", &easeInOutElastic},
+        {"easeInBounce", &easeInBounce}, {"easeOutBounce", &easeOutBounce}, {"easeInOutBounce", &easeInOutBounce},
+    };
+    const int steps = 1024;
+    for (const auto& f : functions) {
+        benchmark(f.first + "/" + std::to_string(steps), [&]() {
+            double sum = 0.0;
+            for (int i = 0; i < steps; i++) {
+                sum += f.second(i / (double)(steps - 1));
+            }
+            return sum;
+        }, 0.0, steps);
+    }
+}
+
+// Benchmarks of the classes
+void benchmark_classes() {
+    FastBoolGenerator generator;
+    benchmark("FastBoolGenerator", [&]() {return generator();}, 0.0, 1);
+
+    for (int size : {16, 1024, 65536}) {
+        Circle<int> circle;
+        PythonicVector<int> vector;
+        for (int i = 0; i < size; i++) {
+            circle.insert(i);
+            vector.push_back(i);
+        }
+        benchmark("Circle/rotate_and_index/" + std::to_string(size), [&]() {
+            circle += 3;
+            return circle[-1] + circle[size / 2];
+        }, 0.0, 1);
+        benchmark("PythonicVector/negative_index/" + std::to_string(size), [&]() {return vector[-1] + vector[-(size / 2)];}, 0.0, 1);
+        benchmark("PythonicVector/slice/" + std::to_string(size), [&]() {return vector(1, -1);}, 0.0, size - 2);
+    }
+}
+
+// Writes all results as JSON, one benchmark per line so that read_baseline() can stay simple
+void write_results(const std::string& filepath) {
+    std::ofstream out(filepath);
+    out << std::setprecision(10) << "{\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "\"" << r.name << "\": {"
+            << "\"min_ns\": " << r.min_ns << ", \"median_ns\": " << r.median_ns << ", \"p99_ns\": " << r.p99_ns << ", \"mean_ns\": " << r.mean_ns
+            << ", \"iterations\": " << r.iterations << ", \"samples\": " << r.samples
+            << ", \"bytes_per_second\": " << r.bytes_per_second << ", \"items_per_second\": " << r.items_per_second << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "}\n";
+}
+
+// Reads the median time of each benchmark from a file written by write_results()
+std::map<std::string, double> read_baseline(const std::string& filepath) {
+    std::map<std::string, double> medians;
+    for (const std::string& line : split(load_file(filepath))) {
+        size_t name_end = line.find("\": {");
+        size_t median = line.find("\"median_ns\": ");
+        if (line.size() < 2 || line[0] != '"' || name_end == std::string::npos || median == std::string::npos) {
+            continue; // Braces, or not a benchmark
+        }
+        const char* number = line.c_str() + median + 13;
+        char* number_end;
+        double value = std::strtod(number, &number_end);
+        if (number_end != number) {
+            medians[line.substr(1, name_end - 1)] = value;
+        }
+    }
+    return medians;
+}
+
+// Prints how each benchmark compares to the baseline, returning the number of regressions
+int compare_to_baseline(const std::map<std::string, double>& baseline, double threshold_percent) {
+    int regressions = 0;
+    std::cout << T_CYAN << "+---------------------+\n| BASELINE COMPARISON |\n+---------------------+" << T_RESET << std::endl;
+    for (const BenchResult& r : results) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second <= 0.0) {
+            std::cout << T_YELLOW << "new       " << T_RESET << r.name << std::endl;
+            continue;
+        }
+        double change = (r.median_ns / it->second - 1.0) * 100.0;
+        std::ostringstream percent;
+        percent << std::fixed << std::setprecision(1) << std::showpos << change << "%";
+        if (change > threshold_percent) {
+            regressions++;
+            std::cout << T_RED << "SLOWER    " << r.name << " " << percent.str() << " (" << bench_format_ns(it->second) << " -> " << bench_format_ns(r.median_ns) << ")" << T_RESET << std::endl;
+        } else if (change < -threshold_percent) {
+            std::cout << T_GREEN << "faster    " << T_RESET << r.name << " " << percent.str() << std::endl;
+        } else {
+            std::cout << "unchanged " << r.name << " " << percent.str() << std::endl;
+        }
+    }
+    if (regressions > 0) {
+        std::cout << T_RED << regressions << " benchmark(s) slowed down by more than " << threshold_percent << "%" << T_RESET << std::endl;
+    } else {
+        std::cout << T_GREEN << "No benchmarks slowed down by more than " << threshold_percent << "%" << T_RESET << std::endl;
+    }
+    return regressions;
+}
+
+int main(int argc, char *argv[]) {
+    std::string output_path = "alexandria_benchmark.json";
+    std::string baseline_path = "";
+    double threshold_percent = 10.0;
+    for (int i = 1; i < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag != "--output" && flag != "--baseline" && flag != "--threshold" && flag != "--filter") {
+            std::cout << T_RED << "Unknown option " << flag << T_RESET << std::endl;
+            return 2;
+        }
+        if (i + 1 >= argc) {
+            std::cout << T_RED << "Missing value for " << flag << T_RESET << std::endl;
+            return 2;
+        }
+        if (flag == "--output") {
+            output_path = argv[i + 1];
+        } else if (flag == "--baseline") {
+            baseline_path = argv[i + 1];
+        } else if (flag == "--threshold") {
+            char* end;
+            threshold_percent = std::strtod(argv[i + 1], &end);
+            if (end == argv[i + 1] || *end != '\0' || !(threshold_percent >= 0.0)) {
+                std::cout << T_RED << "Invalid threshold " << argv[i + 1] << ", expected a non-negative percentage" << T_RESET << std::endl;
+                return 2;
+            }
+        } else if (flag == "--filter") {
+            name_filter = argv[i + 1];
+        }
+    }
+
+    // Read the baseline first, so that a wrong path fails the run instead of passing it after every benchmark has run
+    std::map<std::string, double> baseline;
+    if (baseline_path != "") {
+        baseline = read_baseline(baseline_path);
+        if (baseline.empty()) {
+            std::cout << T_RED << "No baseline results could be read from " << baseline_path << T_RESET << std::endl;
+            return 2;
+        }
+    }
+
+    benchmark_strings();
+    benchmark_images_and_matrices();
+    benchmark_vectors();
+    benchmark_easing();
+    benchmark_classes();
+
+    write_results(output_path);
+    std::cout << "Wrote " << results.size() << " results to " << output_path << std::endl;
+
+    if (baseline_path != "") {
+        return compare_to_baseline(baseline, threshold_percent) > 0 ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+// Checks that every arithmetic type (and nullptr) compiles in a binary LOG(x) and decodes to the text a stream would have printed
+// Build: g++ -std=c++14 -O2 -pthread alexandria_binary_log_test.cpp -o alexandria_binary_log_test
+// Usage: ./alexandria_binary_log_test, which exits with 1 if any value decodes differently
+
+#define DEBUG
+#define USE_ALEXANDRIA_BINARY_LOG
+#include "alexandria.hpp"
+
+#define BINARY_LOG_TEST_PATH "alexandria_binary_log_test.bin"
+
+std::vector<std::string> expected;
+
+// Logs a value, remembering how a stream prints it
+template <typename T>
+void log_value(const T& value) {
+    std::ostringstream text;
+    text << "[" << value << "]";
+    expected.push_back(text.str());
+    LOG("[" << value << "]")
+}
+
+int main() {
+    if (!binary_log_open(BINARY_LOG_TEST_PATH)) {
+        std::cerr << "Could not open " << BINARY_LOG_TEST_PATH << std::endl;
+        return 1;
+    }
+    log_value(true);
+    log_value('c');
+    log_value((signed char)'s');
+    log_value((unsigned char)'u');
+    log_value(L'w');
+    log_value(u'x');
+    log_value(U'y');
+    log_value((short)-12);
+    log_value((unsigned short)34);
+    log_value(-56);
+    log_value(78u);
+    log_value(-90L);
+    log_value(12UL);
+    log_value(-3456789012345LL);
+    log_value(18446744073709551615ULL);
+    log_value(1.25f);
+    log_value(3.141592653589793);
+    log_value(2.718281828459045235360287L);
+    expected.push_back("[nullptr]");
+    LOG("[" << nullptr << "]")
+    LOG_FLUSH()
+
+    std::ifstream in(BINARY_LOG_TEST_PATH, std::ios::binary);
+    std::ostringstream decoded;
+    TEST(binary_log_decode(in, decoded))
+    in.close();
+    std::remove(BINARY_LOG_TEST_PATH);
+
+    std::istringstream lines(decoded.str());
+    std::string line;
+    for (size_t i = 0; i < expected.size(); i++) {
+        std::getline(lines, line);
+        std::string value = line.size() < expected[i].size() ? line : line.substr(line.size() - expected[i].size()); // After the colored prefix
+        TEST_EQ(value, expected[i])
+    }
+    TEST_SUMMARY()
+    return TESTS_FAILURES.empty() ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+// Decoder for binary logs written with USE_ALEXANDRIA_BINARY_LOG, printing the same text LOG/PASS/WARNING/ERROR would have printed
+// Build: g++ -std=c++14 -O2 -pthread alexandria_log_decoder.cpp -o alexandria_log_decoder
+// Usage: ./alexandria_log_decoder [--locations] [alexandria_log.bin]
+//  --locations: Also print the file:line:function each message was logged from
+
+#define USE_ALEXANDRIA_BINARY_LOG
+#include "alexandria.hpp"
+
+int main(int argc, char** argv) {
+    std::string path = BINARY_LOG_PATH;
+    bool show_locations = false;
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--locations") {
+            show_locations = true;
+        } else if (argument == "--help" || argument == "-h") {
+            std::cout << "Usage: " << argv[0] << " [--locations] [" << BINARY_LOG_PATH << "]" << std::endl;
+            return 0;
+        } else {
+            path = argument;
+        }
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Could not open " << path << std::endl;
+        return 1;
+    }
+    if (!binary_log_decode(in, std::cout, show_locations)) {
+        std::cout << std::flush;
+        std::cerr << "Binary log " << path << " is malformed or cut off" << std::endl;
+        return 1;
+    }
+    return 0;
+}